@@ -2,6 +2,7 @@
 #include "math/math.h"
 #include "hal/threading.h"
 #include "misc/command_line.h"
+#include "misc/time.h"
 #include "chord/chord.h"
 
 /// The global allocator used by default
@@ -24,16 +25,77 @@ int32 main(int32 argc, char ** argv)
 	gThreadManager = new ThreadManager();
 	gCommandLine = new CommandLine(argc, argv);
 	
-	Chord::LocalNode localNode;
+	// Number of ring positions of this process
+	uint32 numNodes = 1;
+	CommandLine::get().getValue("vnodes", numNodes);
+
+	// Fixed port, keeps node ids across restarts
+	uint16 port = 0;
+	CommandLine::get().getValue("port", port);
+
+	// Pending requests of each node, raise
+	// it on high fan-out lookup gateways
+	uint32 maxRequests = Chord::LocalNode::DEFAULT_MAX_REQUESTS;
+	CommandLine::get().getValue("max-requests", maxRequests);
+
+	Chord::VirtualHost host{numNodes, port, maxRequests};
+	if (!host.isInit()) return 1;
+
+	Chord::LocalNode & localNode = host.getNode(0);
+
+	// Keep keys on disk
+	char dataPath[256] = {};
+	const bool bPersistent = CommandLine::get().getValue("data", dataPath, [](const String & str, char (&path)[256]) {
+
+		snprintf(path, sizeof(path), "%.*s", (int32)str.getLength(), *str);
+	});
+	if (bPersistent && !host.openStores(dataPath)) return 1;
+
+	// Copies of each key kept on successors,
+	// and replica acks a write waits for
+	uint32 numReplicas = 2, writeQuorum = 1;
+	CommandLine::get().getValue("replicas", numReplicas);
+	CommandLine::get().getValue("quorum", writeQuorum);
+
+	for (uint32 i = 0; i < host.getNumNodes(); ++i)
+	{
+		Chord::LocalNode & node = host.getNode(i);
+
+		// Let the source drive lookups
+		if (CommandLine::get().getValue("iterative")) node.setLookupMode(Chord::LocalNode::ITERATIVE);
+
+		// Race a second hop when the first one is slower
+		// than its usual RTT, and at least this many ms
+		float32 hedgeDelay;
+		if (CommandLine::get().getValue("hedge", hedgeDelay)) node.setHedgeDelay(hedgeDelay / 1000.f);
+
+		// Move node id to shed load
+		if (CommandLine::get().getValue("balance")) node.setLoadBalancing(true);
+
+		node.setReplication(numReplicas, writeQuorum);
+	}
+
+	// Join replies and maintenance are
+	// handled by the receiver
+	auto receiver = RunnableThread::create(new Chord::ReceiveTask(&host), "Receiver");
+	auto storer = bPersistent ? RunnableThread::create(new Chord::StoreTask(&host), "Storer") : nullptr;
 
 	Net::Ipv4 peer;
-	if (CommandLine::get().getValue("input", peer, [](const String & str, Net::Ipv4 & peer){
+	if (!CommandLine::get().getValue("input", peer, [](const String & str, Net::Ipv4 & peer){
 
 		Net::parseIpString(peer, *str);
-	})) localNode.join(peer);
+	}))
+		// First host of a new ring
+		host.create();
+	else if (!host.join(peer))
+	{
+		printf("INFO: could not join ring through %s\n", *Net::getIpString(peer));
 
-	auto receiver = RunnableThread::create(new Chord::ReceiveTask(&localNode), "Receiver");
-	auto updater = RunnableThread::create(new Chord::UpdateTask(&localNode), "Updater");
+		receiver->kill();
+		if (storer) storer->kill();
+
+		return 1;
+	}
 
 	char line[256] = {};
 	char c; do
@@ -42,7 +104,8 @@ int32 main(int32 argc, char ** argv)
 		{
 		case 'p':
 		{
-			localNode.printInfo();
+			for (uint32 i = 0; i < host.getNumNodes(); ++i)
+				host.getNode(i).printInfo();
 			break;
 		}
 
@@ -51,14 +114,69 @@ int32 main(int32 argc, char ** argv)
 			uint32 key;
 			scanf("%x", &key);
 
+			const float64 startTime = getTime();
 			auto peer = localNode.lookup(key);
-			printf("RESULT: found key 0x%08x @ [%s]\n", key, *peer.get().getInfoString());
+			const Chord::NodeInfo & owner = peer.get();
+			printf("RESULT: found key 0x%08x @ [%s] in %.2f ms\n", key, *owner.getInfoString(), (getTime() - startTime) * 1000.0);
 			break;
 		}
 		
+		case 'm':
+		{
+			uint32 numKeys;
+			scanf("%u", &numKeys);
+
+			uint32 keys[256];
+			Chord::NodeInfo results[256];
+			numKeys = Math::min(numKeys, 256U);
+
+			for (uint32 i = 0; i < numKeys; ++i)
+				scanf("%x", keys + i);
+
+			localNode.lookupMany(keys, numKeys, results).get();
+			for (uint32 i = 0; i < numKeys; ++i)
+				printf("RESULT: found key 0x%08x @ [%s]\n", keys[i], *results[i].getInfoString());
+			break;
+		}
+
+		case 's':
+		{
+			uint32 key;
+			scanf("%x %255s", &key, line);
+
+			const bool bStored = localNode.put(key, line, strlen(line) + 1).get();
+			printf("RESULT: %s key 0x%08x\n", bStored ? "stored" : "could not store", key);
+			break;
+		}
+
+		case 'g':
+		{
+			uint32 key;
+			scanf("%x", &key);
+
+			char value[Chord::KeyStore::MAX_VALUE_SIZE + 1] = {};
+			uint32 size = Chord::KeyStore::MAX_VALUE_SIZE;
+
+			const float64 startTime = getTime();
+			if (localNode.get(key, value, size).get())
+				printf("RESULT: key 0x%08x = '%s' in %.2f ms\n", key, value, (getTime() - startTime) * 1000.0);
+			else
+				printf("RESULT: key 0x%08x not found\n", key);
+			break;
+		}
+
+		case 'd':
+		{
+			uint32 key;
+			scanf("%x", &key);
+
+			printf("RESULT: %s key 0x%08x\n", localNode.remove(key).get() ? "removed" : "not found", key);
+			break;
+		}
+
 		case 'q':
 		{
-			localNode.leave();
+			host.leave();
 			break;
 		}
 
@@ -67,5 +185,9 @@ int32 main(int32 argc, char ** argv)
 		}
 	} while(c != 'q');
 
+	// Stop tasks before node goes out of scope
+	receiver->kill();
+	if (storer) storer->kill();
+
 	return 0;
 }
\ No newline at end of file
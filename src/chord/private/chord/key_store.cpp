@@ -0,0 +1,495 @@
+#include "chord/key_store.h"
+#include "hal/platform_memory.h"
+
+#include <unistd.h>
+
+namespace Chord
+{
+	KeyStore::KeyStore(uint32 _numShards)
+		: shards{nullptr}
+		, numShards{1U}
+		, shardBits{0U}
+		, log{nullptr}
+	{
+		if (_numShards == 0) _numShards = (uint32)Math::max(::sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+		while (numShards < _numShards && shardBits < 8)
+			numShards <<= 1, ++shardBits;
+
+		shards = new Shard[numShards];
+
+		for (uint32 i = 0; i < numShards; ++i)
+		{
+			Shard & shard = shards[i];
+			shard.entries = nullptr;
+			shard.capacity = 0;
+			shard.count = 0;
+			shard.numUsed = 0;
+			shard.numDigests = 0;
+			shard.digestTime = 0;
+
+			resize(shard, 16U);
+		}
+	}
+
+	KeyStore::~KeyStore()
+	{
+		for (uint32 i = 0; i < numShards; ++i)
+		{
+			Shard & shard = shards[i];
+
+			for (uint32 j = 0; j < shard.capacity; ++j)
+				if (shard.entries[j].value && shard.entries[j].segment == SegmentLog::NONE) gMalloc->free(shard.entries[j].value);
+
+			gMalloc->free(shard.entries);
+		}
+
+		delete[] shards;
+		delete log;
+	}
+
+	uint32 KeyStore::getCount() const
+	{
+		uint32 count = 0;
+		for (uint32 i = 0; i < numShards; ++i)
+			count += shards[i].count;
+
+		return count;
+	}
+
+	bool KeyStore::open(const char * path)
+	{
+		log = new SegmentLog;
+		if (!log->open(path))
+		{
+			delete log;
+			log = nullptr;
+
+			return false;
+		}
+
+		// Rebuild index, records that are
+		// replaced or removed are dead. Sizes
+		// and checksums come from the index
+		// of the log, values are not read
+		log->replay([this](uint32 segment, uint32 key, const ubyte * value, uint32 size, uint32 checksum) {
+
+			const uint32 hash = getHash(key);
+			Shard & shard = getShard(hash);
+			Entry * entry = find(shard, key, hash);
+
+			if (entry) release(*entry);
+
+			if (size == SegmentLog::TOMBSTONE)
+			{
+				log->release(segment, size);
+				if (!entry) return;
+
+				entry->value = nullptr;
+				entry->size = TOMBSTONE;
+				entry->removeTime = getSeconds();
+				--shard.count;
+			}
+			else if (entry)
+			{
+				entry->value = const_cast<ubyte*>(value);
+				entry->size = size;
+				entry->segment = segment;
+				entry->checksum = checksum;
+			}
+			else
+				insert(shard, key, hash, const_cast<ubyte*>(value), size, segment, checksum);
+		});
+
+		return true;
+	}
+
+	uint32 KeyStore::flush()
+	{
+		return log ? log->flush() : 0;
+	}
+
+	bool KeyStore::compact(uint32 & numMoved)
+	{
+		numMoved = 0;
+		if (!log) return false;
+
+		const uint32 segment = log->getCompactionCandidate();
+		if (segment == SegmentLog::NONE) return false;
+
+		// Tombstones in the oldest segment
+		// have nothing left to hide
+		const bool bOldest = log->isOldest(segment);
+		bool bMoved = true;
+
+		log->forEachRecord(segment, [&](uint32 key, const ubyte * value, uint32 size, uint32 checksum) {
+
+			if (!bMoved) return;
+
+			const uint32 hash = getHash(key);
+			Shard & shard = getShard(hash);
+
+			shard.guard.writeLock();
+
+			Entry * entry = find(shard, key, hash);
+			uint32 newSegment;
+
+			if (size == SegmentLog::TOMBSTONE)
+			{
+				// Keep tombstone only if key was
+				// not written again since
+				if (!entry && !bOldest)
+				{
+					bMoved = log->append(key, nullptr, size, 0, newSegment) != nullptr;
+					if (bMoved) log->release(newSegment, size);
+				}
+			}
+			else if (entry && entry->value == value)
+			{
+				// Record is live, copy it
+				// to the active segment
+				ubyte * newValue = log->append(key, value, size, checksum, newSegment);
+				if ((bMoved = newValue != nullptr))
+				{
+					entry->value = newValue;
+					entry->segment = newSegment;
+					++numMoved;
+				}
+			}
+
+			shard.guard.writeUnlock();
+		});
+
+		if (!bMoved) return false;
+
+		// Copies must be on disk before
+		// the segment is deleted
+		log->flush();
+		log->drop(segment);
+
+		return true;
+	}
+
+	bool KeyStore::put(uint32 key, const void * data, uint32 size)
+	{
+		if (size > MAX_VALUE_SIZE) return false;
+
+		const uint32 hash = getHash(key);
+		Shard & shard = getShard(hash);
+
+		ubyte * value = nullptr;
+		uint32 segment = SegmentLog::NONE;
+		const uint32 checksum = SegmentLog::getChecksum(data, size);
+
+		if (!log)
+		{
+			// Copy value out of the lock
+			value = reinterpret_cast<ubyte*>(gMalloc->malloc(Math::max(size, 1U)));
+			Memory::memcpy(value, data, size);
+		}
+
+		shard.guard.writeLock();
+
+		// Append under the shard lock, so that
+		// log order matches index order
+		if (log && !(value = log->append(key, data, size, checksum, segment)))
+		{
+			shard.guard.writeUnlock();
+			return false;
+		}
+
+		Entry * entry = find(shard, key, hash);
+		if (entry)
+		{
+			// Replace value
+			release(*entry);
+			updateDigests(shard, key, entry->checksum, true);
+
+			entry->value = value;
+			entry->size = size;
+			entry->segment = segment;
+			entry->checksum = checksum;
+		}
+		else
+			insert(shard, key, hash, value, size, segment, checksum);
+
+		updateDigests(shard, key, checksum, false);
+
+		shard.guard.writeUnlock();
+
+		return true;
+	}
+
+	bool KeyStore::get(uint32 key, void * data, uint32 & size)
+	{
+		const uint32 hash = getHash(key);
+		Shard & shard = getShard(hash);
+
+		shard.guard.readLock();
+
+		const Entry * entry = find(shard, key, hash);
+		bool bFound = entry != nullptr;
+
+		if (bFound)
+		{
+			// Values in the log are checked when
+			// read, the index is rebuilt without
+			// reading them
+			if (entry->segment != SegmentLog::NONE && SegmentLog::getChecksum(entry->value, entry->size) != entry->checksum)
+			{
+				printf("LOG: value of key 0x%08x is damaged\n", key);
+				bFound = false;
+			}
+			else
+			{
+				size = Math::min(size, entry->size);
+				Memory::memcpy(data, entry->value, size);
+			}
+		}
+
+		shard.guard.readUnlock();
+
+		return bFound;
+	}
+
+	bool KeyStore::remove(uint32 key)
+	{
+		const uint32 hash = getHash(key);
+		Shard & shard = getShard(hash);
+
+		shard.guard.writeLock();
+
+		Entry * entry = find(shard, key, hash);
+		const bool bRemoved = entry && erase(shard, *entry);
+
+		shard.guard.writeUnlock();
+
+		return bRemoved;
+	}
+
+	bool KeyStore::remove(uint32 key, uint32 checksum)
+	{
+		const uint32 hash = getHash(key);
+		Shard & shard = getShard(hash);
+
+		shard.guard.writeLock();
+
+		Entry * entry = find(shard, key, hash);
+		const bool bRemoved = entry && entry->checksum == checksum && erase(shard, *entry);
+
+		shard.guard.writeUnlock();
+
+		return bRemoved;
+	}
+
+	bool KeyStore::isRemoved(uint32 key)
+	{
+		const uint32 hash = getHash(key);
+		Shard & shard = getShard(hash);
+		const uint32 now = getSeconds();
+
+		shard.guard.readLock();
+
+		bool bRemoved = false;
+		if (!find(shard, key, hash))
+		{
+			// Tombstone is in the probe
+			// sequence of key
+			const uint32 mask = shard.capacity - 1;
+			for (uint32 i = hash & mask, n = 0; n < shard.capacity; i = (i + 1) & mask, ++n)
+			{
+				const Entry & entry = shard.entries[i];
+				if (!entry.value && entry.size != TOMBSTONE) break;
+				if (entry.key == key && isFresh(entry, now))
+				{
+					bRemoved = true;
+					break;
+				}
+			}
+		}
+
+		shard.guard.readUnlock();
+
+		return bRemoved;
+	}
+
+	bool KeyStore::getChecksum(uint32 key, uint32 & checksum)
+	{
+		const uint32 hash = getHash(key);
+		Shard & shard = getShard(hash);
+
+		shard.guard.readLock();
+
+		const Entry * entry = find(shard, key, hash);
+		if (entry) checksum = entry->checksum;
+
+		shard.guard.readUnlock();
+
+		return entry != nullptr;
+	}
+
+	void KeyStore::getDigests(RangeDigest * ranges, uint32 n)
+	{
+		for (uint32 i = 0; i < n; ++i)
+			ranges[i].numKeys = ranges[i].digest = 0;
+
+		for (uint32 i = 0; i < numShards; ++i)
+		{
+			Shard & shard = shards[i];
+
+			// New ranges are scanned
+			// and added to the shard
+			shard.guard.writeLock();
+			++shard.digestTime;
+
+			for (uint32 j = 0; j < n; ++j)
+			{
+				const RangeDigest & digest = findDigest(shard, ranges[j].start, ranges[j].end);
+				ranges[j].numKeys += digest.numKeys;
+				ranges[j].digest += digest.digest;
+			}
+
+			shard.guard.writeUnlock();
+		}
+	}
+
+	const RangeDigest & KeyStore::findDigest(Shard & shard, uint32 start, uint32 end)
+	{
+		uint32 slot = 0;
+
+		for (uint32 i = 0; i < shard.numDigests; ++i)
+		{
+			Digest & digest = shard.digests[i];
+			if (digest.range.start == start && digest.range.end == end)
+			{
+				digest.lastUse = shard.digestTime;
+				return digest.range;
+			}
+
+			if (digest.lastUse < shard.digests[slot].lastUse) slot = i;
+		}
+
+		// Replace least recently used
+		if (shard.numDigests < MAX_DIGESTS) slot = shard.numDigests++;
+
+		Digest & digest = shard.digests[slot];
+		digest.range = RangeDigest{start, end, 0U, 0U};
+		digest.lastUse = shard.digestTime;
+
+		for (uint32 i = 0; i < shard.capacity; ++i)
+		{
+			const Entry & entry = shard.entries[i];
+			if (!entry.value || !rangeOpenClosed(entry.key, start, end)) continue;
+
+			++digest.range.numKeys;
+			digest.range.digest += getDigest(entry.key, entry.checksum);
+		}
+
+		return digest.range;
+	}
+
+	void KeyStore::insert(Shard & shard, uint32 key, uint32 hash, ubyte * value, uint32 size, uint32 segment, uint32 checksum)
+	{
+		const uint32 now = getSeconds();
+
+		// Keep load factor below 3/4, fresh
+		// tombstones count as keys
+		if ((shard.numUsed + 1) * 4 > shard.capacity * 3)
+		{
+			uint32 numKept = shard.count;
+			for (uint32 j = 0; j < shard.capacity; ++j)
+				if (isFresh(shard.entries[j], now)) ++numKept;
+
+			resize(shard, numKept * 2 >= shard.capacity / 2 ? shard.capacity * 2 : shard.capacity);
+		}
+
+		// First empty entry, or removed entry
+		// of the same key or expired
+		const uint32 mask = shard.capacity - 1;
+		uint32 i = hash & mask;
+		while (shard.entries[i].value || (shard.entries[i].key != key && isFresh(shard.entries[i], now))) i = (i + 1) & mask;
+
+		if (shard.entries[i].size != TOMBSTONE) ++shard.numUsed;
+		++shard.count;
+
+		shard.entries[i] = Entry{key, size, value, segment, checksum};
+	}
+
+	bool KeyStore::erase(Shard & shard, Entry & entry)
+	{
+		if (log)
+		{
+			// Tombstones are dead as soon
+			// as they are written
+			uint32 segment;
+			if (!log->append(entry.key, nullptr, SegmentLog::TOMBSTONE, 0, segment)) return false;
+
+			log->release(segment, SegmentLog::TOMBSTONE);
+		}
+
+		release(entry);
+		updateDigests(shard, entry.key, entry.checksum, true);
+
+		entry.value = nullptr;
+		entry.size = TOMBSTONE;
+		entry.removeTime = getSeconds();
+
+		--shard.count;
+
+		return true;
+	}
+
+	void KeyStore::release(const Entry & entry)
+	{
+		if (entry.segment == SegmentLog::NONE)
+			gMalloc->free(entry.value);
+		else
+			log->release(entry.segment, entry.size);
+	}
+
+	KeyStore::Entry * KeyStore::find(Shard & shard, uint32 key, uint32 hash)
+	{
+		const uint32 mask = shard.capacity - 1;
+
+		// Probe until an empty entry, skip
+		// removed ones
+		for (uint32 i = hash & mask, n = 0; n < shard.capacity; i = (i + 1) & mask, ++n)
+		{
+			Entry & entry = shard.entries[i];
+
+			if (entry.value && entry.key == key) return &entry;
+			if (!entry.value && entry.size != TOMBSTONE) break;
+		}
+
+		return nullptr;
+	}
+
+	void KeyStore::resize(Shard & shard, uint32 capacity)
+	{
+		Entry * entries = shard.entries;
+		const uint32 oldCapacity = shard.capacity;
+		const uint32 now = getSeconds();
+
+		shard.entries = reinterpret_cast<Entry*>(gMalloc->malloc(capacity * sizeof(Entry)));
+		shard.capacity = capacity;
+		shard.numUsed = shard.count;
+
+		Memory::memset(shard.entries, 0, capacity * sizeof(Entry));
+
+		// Reinsert live entries and
+		// fresh tombstones
+		const uint32 mask = capacity - 1;
+		for (uint32 j = 0; j < oldCapacity; ++j)
+		{
+			if (!entries[j].value && !isFresh(entries[j], now)) continue;
+			if (!entries[j].value) ++shard.numUsed;
+
+			uint32 i = getHash(entries[j].key) & mask;
+			while (shard.entries[i].value || shard.entries[i].size == TOMBSTONE) i = (i + 1) & mask;
+
+			shard.entries[i] = entries[j];
+		}
+
+		if (entries) gMalloc->free(entries);
+	}
+} // namespace Chord
@@ -1,25 +1,206 @@
 #include "chord/local_node.h"
 #include "crypto/sha1.h"
+#include "containers/sorting.h"
+
+#include <time.h>
+#include <unistd.h>
 
 namespace Chord
 {
-	LocalNode::LocalNode()
+	/**
+	 * Shared state of a batched lookup
+	 */
+	struct LookupBatch
+	{
+		/// Caller results buffer
+		NodeInfo * results;
+
+		/// Number of keys in batch
+		uint32 numKeys;
+
+		/// Number of keys not yet resolved
+		uint32 numPending;
+
+		/// Next hops of the batch
+		NodeInfo hops[33];
+
+		/// Number of next hops
+		uint32 numHops;
+
+		/// Completion promise
+		Promise<void> promise;
+
+		/// Guards results
+		CriticalSection guard;
+
+		/// Write resolved keys, complete
+		/// batch when all keys are resolved
+		void resolve(const LookupResult * entries, uint32 n)
+		{
+			ScopeLock _(&guard);
+
+			// Batch failed in the meantime
+			if (numPending == 0) return;
+
+			for (uint32 i = 0; i < n; ++i)
+			{
+				const LookupResult & entry = entries[i];
+				if (entry.index < numKeys) results[entry.index] = entry.node;
+			}
+
+			numPending = numPending > n ? numPending - n : 0;
+			if (numPending == 0) promise.set();
+		}
+
+		/// Complete batch, pending keys
+		/// are left unresolved
+		void fail()
+		{
+			ScopeLock _(&guard);
+
+			if (numPending == 0) return;
+
+			numPending = 0;
+			promise.set();
+		}
+	};
+
+	/**
+	 * Shared state of a write copied
+	 * to the replicas of a key, or
+	 * waiting to be synced to disk
+	 */
+	struct ReplicatedWrite
+	{
+		/// Reply to source, if remote
+		RequestBuffer res;
+
+		/// Write future, if local
+		Promise<bool> result;
+
+		/// Whether source is remote
+		bool bRemote;
+
+		/// Number of acks that
+		/// complete the write
+		uint32 quorum;
+
+		/// Number of acks received
+		uint32 numAcks;
+
+		/// Number of replicas that
+		/// did not reply yet
+		uint32 numPending;
+
+		/// Whether write was completed
+		bool bDone;
+
+		/// Whether write is on disk, always
+		/// true if store is not persistent
+		bool bSynced;
+
+		/// Write ticket of store
+		uint64 ticket;
+
+		/// Next write waiting for a sync
+		SharedPtr<ReplicatedWrite> nextSync;
+
+		/// Guards counters
+		CriticalSection guard;
+
+		/// Count replica replies, complete write
+		/// once quorum is reached or no replica
+		/// is left to reply, and once synced
+		void update(SocketDgram & socket, uint32 acks, uint32 replies)
+		{
+			ScopeLock _(&guard);
+
+			numAcks += acks;
+			numPending -= replies;
+
+			if (bDone || !bSynced || (numAcks < quorum && numPending > 0)) return;
+			bDone = true;
+
+			const bool bOk = numAcks >= quorum;
+			if (!bRemote)
+				result.set(bOk);
+			else if (res.header.id != RequestTable::INVALID_ID)
+			{
+				// Fail if quorum was not reached
+				if (!bOk) res.header.numEntries = 0;
+				socket.write(&res, res.header.getSize(), res.header.recipient);
+			}
+		}
+
+		/// Mark write synced, complete
+		/// it if replicas are done
+		void sync(SocketDgram & socket)
+		{
+			ScopeLock _(&guard);
+
+			bSynced = true;
+			update(socket, 0, 0);
+		}
+	};
+
+	LocalNode::LocalNode(SocketDgram & _socket, uint32 index, uint32 maxRequests)
 		: self{}
 		, fingers{}
+		, successors{}
+		, numSuccessors{0U}
 		, predecessor{}
-		, socket{}
-		, requestIdGenerator{}
-		, callbacks{}
-		, nextFinger{1U}
+		, socket{_socket}
+		, epoch{0U}
+		, prevId{0U}
+		, requests{maxRequests, 32U}
+		, timeouts{0.05f, requests.getCapacity()}
+		, rtts{}
+		, lookupsMalloc{sizeof(LookupMap::Node)}
+		, lookups{&lookupsMalloc}
+		, nextLookupSeq{0U}
+		, locations{}
+		, lookupMode{RECURSIVE}
+		, hedgeDelay{0.f}
+		, fingersPeriod{(float32)MIN_FINGERS_PERIOD}
+		, nextFingersTime{0.0}
+		, numFingerChanges{0U}
+		, ringSize{1U}
+		, firstFinger{1U}
+		, candidates{nullptr}
+		, numCandidateSets{0U}
+		, load{}
+		, successorLoad{0.f}
+		, lastNumRequests{0U}
+		, lastLoadTime{0.0}
+		, lastMoveTime{0.0}
+		, bLoadBalancing{false}
+		, store{}
+		, numReplicas{2U}
+		, writeQuorum{1U}
+		, replicaRanges{}
+		, numReplicaRanges{0U}
+		, handoffs{}
+		, sentHandoffs{}
+		, numFreeHandoffs{HANDOFF_WINDOW}
+		, numHandedOff{0U}
+		, bLeaving{false}
+		, leaving{nullptr}
+		, syncsHead{nullptr}
+		, syncsTail{nullptr}
+		, onRequest{}
+		, onWrite{}
 	{
+		for (uint32 i = 0; i < HANDOFF_WINDOW; ++i)
+			freeHandoffs[i] = HANDOFF_WINDOW - 1 - i;
+
 		// Initialize node
-		init();
+		init(index);
 	}
 
-	bool LocalNode::init()
+	bool LocalNode::init(uint32 index)
 	{
-		// Initialize socket
-		if (socket.init() && socket.bind())
+		// Socket is bound by the host
+		if (socket.isInit())
 		{
 			// Get node public address
 			// TODO: depending on are visibility
@@ -28,14 +209,27 @@ namespace Chord
 			getInterfaceAddr(self.addr);
 
 			{
-				// Compute sha-1 of address
-				uint32 hash[5]; Crypto::sha1(getIpString(self.addr), hash);
+				// Compute sha-1 of address, virtual
+				// nodes append their index
+				char name[INET_ADDRSTRLEN + 1 + 6 + 1 + 10];
+				getIpString(self.addr, name, sizeof(name));
+				if (index > 0) snprintf(name + strlen(name), sizeof(name) - strlen(name), "#%u", index);
+
+				uint32 hash[5]; Crypto::sha1(String(name), hash);
 
 				// We use the first 32-bit
 				// Uniform distribution
 				id = hash[0];
+				prevId = id;
 			}
 
+			// Replies addressed to a previous
+			// run of this node are discarded
+			epoch = (uint32)::time(nullptr) ^ ((uint32)::getpid() << 16);
+
+			// Start at the origin, with max error
+			self.coord = NetCoord{{0.f, 0.f}, 0.f, 1.f};
+
 			// Init predecessor, successor and finger table
 			predecessor = self;
 			for (uint32 i = 0; i < 32; ++i)
@@ -51,212 +245,1861 @@ namespace Chord
 	const NodeInfo & LocalNode::findSuccessor(uint32 key) const
 	{
 		const uint32 offset = key - id;
+		const uint32 first = firstFinger.load(AtomicOrder::Relaxed);
 
-		for (uint32 i = Math::getP2Index(offset, 32); i > 0; --i)
+		for (uint32 i = Math::getP2Index(offset, 32); i >= first; --i)
 			if (rangeOpen(fingers[i].id, id, key)) return fingers[i];
 		
 		// Return successor if all other fingers failed
 		return successor;
 	}
 
-	Request LocalNode::makeRequest(Request::Type type, const NodeInfo & recipient, RequestCallback::CallbackT && onSuccess, RequestCallback::ErrorT && onError, uint32 ttl)
+	const NodeInfo * LocalNode::findAlternateHop(uint32 key, const NodeInfo & other) const
+	{
+		const uint32 offset = key - id;
+		const uint32 first = firstFinger.load(AtomicOrder::Relaxed);
+
+		for (uint32 i = Math::getP2Index(offset, 32); i >= first; --i)
+			if (fingers[i].id != other.id && rangeOpen(fingers[i].id, id, key)) return fingers + i;
+		
+		// Fallback to successor
+		return successor.id != other.id && successor.id != id ? &successor : nullptr;
+	}
+
+	LocalNode::~LocalNode()
+	{
+		if (candidates) gMalloc->free(candidates);
+	}
+
+	uint32 LocalNode::registerRequest(RequestCallback && callback, float32 timeout, uint32 numUnits)
+	{
+		const uint32 reqId = requests.insert(::move(callback), numUnits);
+
+		if (reqId != RequestTable::INVALID_ID)
+		{
+			timeouts.arm(requests.getIndex(reqId), reqId, timeout);
+			if (onRequest) onRequest();
+		}
+		else
+			printf("LOG: too many pending requests, reply will be ignored\n");
+		
+		return reqId;
+	}
+
+	bool LocalNode::acquireRequest(uint32 reqId, uint32 numUnits, RequestCallback & callback)
+	{
+		bool bRemoved;
+		if (!requests.acquire(reqId, numUnits, callback, bRemoved)) return false;
+
+		if (bRemoved) timeouts.cancel(requests.getIndex(reqId), reqId);
+		return true;
+	}
+
+	bool LocalNode::cancelRequest(uint32 reqId)
+	{
+		RequestCallback callback;
+		if (!requests.remove(reqId, callback)) return false;
+
+		timeouts.cancel(requests.getIndex(reqId), reqId);
+		return true;
+	}
+
+	float32 LocalNode::getLookupTimeout(const NodeInfo & next)
+	{
+		// A lookup takes about half of
+		// log2(N) hops in a ring of N nodes
+		const uint32 numHops = Math::getP2Index(getRingSize()) / 2 + 1;
+
+		// Other hops are assumed to be
+		// as far as the first one
+		return rtts.getTimeout(next.addr) * numHops;
+	}
+
+	float32 LocalNode::getHedgeDelay(const NodeInfo & next)
+	{
+		const uint32 numHops = Math::getP2Index(getRingSize()) / 2 + 1;
+
+		// With normal samples the mean deviation is
+		// about 0.8 sigma, so two deviations above
+		// the mean are close to the 95th percentile
+		float32 rtt = rtts.getRttBound(next.addr, 2.f);
+		if (rtt <= 0.f)
+			// Fallback to predicted RTT, or to
+			// the timeout if we know nothing
+			rtt = canPredictRtt(next) ? predictRtt(next) : rtts.getTimeout(next.addr);
+
+		return Math::max(rtt * numHops, hedgeDelay);
+	}
+
+	Request LocalNode::makeRequest(Request::Type type, const NodeInfo & recipient, RequestCallback::CallbackT && onSuccess, RequestCallback::ErrorT && onError, float32 timeout, uint32 ttl)
 	{
 		Request out{type};
 		out.sender = self.addr;
 		out.recipient = recipient.addr;
+		out.target = recipient.id;
+		out.version = Request::VERSION;
 		out.flags = 0;
+		out.epoch = epoch;
 		out.ttl = ttl;
 		out.hopCount = 0;
+		out.payloadSize = 0;
+		out.numEntries = 0;
 
-		// Assign unique id
-		out.id = requestIdGenerator.getNext();
+		// Requests without callback
+		// don't expect a reply
+		out.id = RequestTable::INVALID_ID;
 
 		// Insert callback
 		if (onSuccess || onError)
 		{
-			ScopeLock _(&callbacksGuard);
-			callbacks.insert(out.id, RequestCallback(::move(onSuccess), onError ? ::move(onError) : [this, recipient]() {
+			// Without an error callback, the
+			// recipient is checked on timeout
+			RequestCallback callback(::move(onSuccess), ::move(onError));
+			callback.recipient = recipient;
+			callback.time = getTime();
 
-				// Check this peer
-				checkPeer(recipient);
-			}, 5.f));
+			out.id = registerRequest(::move(callback), timeout > 0.f ? timeout : rtts.getTimeout(recipient.addr));
 		}
 
 		return out;
 	}
 
-	bool LocalNode::join(const Ipv4 & peer)
+	bool LocalNode::join(const Ipv4 & peer, uint32 numAttempts)
 	{
-		// Join starts with a lookup request
-		Request req = makeRequest(
-			Request::LOOKUP,
-			NodeInfo{(uint32)-1, peer}
-		);
-		req.setSrc<NodeInfo>(self);
-		req.setDst<uint32>(id);
+		const NodeInfo bootstrap{(uint32)-1, peer};
 
-		// Send lookup request
-		socket.write<Request>(req, req.recipient);
+		for (uint32 attempt = 0; attempt < numAttempts && successor.id == id; ++attempt)
+		{
+			Promise<bool> found;
+
+			// Join starts with a lookup request, a
+			// timed out request backs off the peer
+			// timeout for the next attempt
+			Request req = makeRequest(
+				Request::LOOKUP,
+				bootstrap,
+				[this, found](const Request & res) mutable {
+
+					setSuccessor(res.getDst<NodeInfo>());
+					found.set(true);
+				},
+				[found]() mutable {
+
+					found.set(false);
+				}
+			);
+			req.setSrc<NodeInfo>(self);
+			req.setDst<uint32>(id);
+
+			// Send lookup request
+			socket.write<Request>(req, req.recipient);
 
-		// Wait for response
-		// TODO: timeout
-		Request res;
-		do socket.read(res, res.sender); while (res.id != req.id);
+			if (!found.get()) printf("LOG: no reply from %s, attempt %u of %u\n", *getIpString(peer), attempt + 1, numAttempts);
+		}
 
-		// Set successor
-		successor = res.getDst<NodeInfo>();
+		if (successor.id == id) return false;
 
 		printf("INFO: connected with successor %s\n", *successor.getInfoString());
+
+		// Notify successor now, it will
+		// in turn update our predecessor
+		stabilize();
+
+		// Fetch successor's finger table and
+		// predecessor, lost or late replies
+		// leave fingers to fixFingers()
+		{
+			Promise<void> fetched;
+
+			Request req = makeRequest(
+				Request::FINGERS,
+				successor,
+				[this, fetched](const Request & res) mutable {
+
+					const NodeInfo & prev = res.getDst<NodeInfo>();
+					const uint32 n = Math::min(res.numEntries, res.payloadSize / (uint32)sizeof(NodeInfo));
+
+					// Successor's predecessor precedes
+					// us, unless we already know better
+					if (prev.id != successor.id && rangeOpen(id, prev.id, successor.id) && predecessor.id == id)
+						setPredecessor(prev);
+
+					seedFingers(res.getPayload<NodeInfo>(), n);
+					fetched.set();
+				},
+				[fetched]() mutable {
+
+					fetched.set();
+				}
+			);
+			req.setSrc<NodeInfo>(self);
+
+			socket.write<Request>(req, req.recipient);
+
+			fetched.get();
+		}
 		
 		return true;
 	}
 
 	Promise<NodeInfo> LocalNode::lookup(uint32 key)
 	{
-		Promise<NodeInfo> out;
+		// Future state is only taken from the
+		// pool once we know we need a new one
+		Promise<NodeInfo> out{nullptr};
+
+		LocationCache::Range range{self, self, 0.0};
 
 		if (rangeOpenClosed(key, id, successor.id))
+		{
+			out = Promise<NodeInfo>{};
 			out.set(successor);
+		}
+		else if (locations.find(key, range) && locations.isFresh(range))
+		{
+			// Range resolved recently
+			out = Promise<NodeInfo>{};
+			out.set(range.owner);
+		}
 		else
 		{
-			// Find closest preceding node
-			const NodeInfo & next = findSuccessor(key);
+			// Ask predecessor of cached owner, which
+			// most likely still has the key in its
+			// successor range, otherwise find closest
+			// preceding node
+			const NodeInfo next = range.owner.id != range.start.id && range.start.id != id ? range.start : findSuccessor(key);
+			uint32 seq;
+
+			{
+				ScopeLock _(&lookupsGuard);
+
+				// Attach to lookup in flight for the
+				// same key. The range of other keys
+				// is unknown until a reply resolves it
+				auto it = lookups.find(key);
+				if (it != lookups.nil()) return it->second.out;
+
+				out = Promise<NodeInfo>{};
+				seq = nextLookupSeq++;
+				lookups.insert(key, PendingLookup{out, next, seq});
+			}
+
+			if (lookupMode == ITERATIVE)
+			{
+				// Source drives the lookup
+				stepLookup(key, seq, next);
+				return out;
+			}
+
+			if (hedgeDelay > 0.f)
+			{
+				// Race a second hop if first one is slow
+				const NodeInfo * alt = findAlternateHop(key, next);
+				if (alt)
+				{
+					hedgeLookup(key, seq, next, *alt);
+					return out;
+				}
+			}
 
 			Request req = makeRequest(
 				Request::LOOKUP,
 				next,
 
 				// * When key is found, set promise
-				[out](const Request & req) mutable {
+				// * of all lookups in range
+				[this, key](const Request & req) {
 
-					out.set(req.getDst<NodeInfo>());
+					completeLookups(key, req);
 				},
 
 				// * If key is not found, we set an invalid
 				// * peer, identified by the wildcard address.
 				// * We also check that the finger we asked
-				// * for the key is not dead
-				[this, out, next]() mutable {
+				// * for the key is not dead. Callbacks only
+				// * capture key and sequence number, which
+				// * fit in the function inline storage
+				[this, key, seq]() {
+
+					NodeInfo next;
+
+					{
+						ScopeLock _(&lookupsGuard);
+
+						// Lookup completed in the meantime
+						PendingLookup * lookup = findLookup(key, seq);
+						if (!lookup) return;
+
+						next = lookup->next;
 
-					// Key not found, something went wrong
-					out.set(NodeInfo{(uint32)-1, Ipv4::any});
+						// Key not found, something went wrong
+						failLookup(key, lookup->out);
+					}
 
 					// Check node
 					checkPeer(next);
 				},
-				3.f
+				getLookupTimeout(next)
 			);
-			req.setSrc<NodeInfo>(self);
-			req.setDst<uint32>(key);
 
-			// Send lookup request
-			socket.write<Request>(req, req.recipient);
+			if (req.id == RequestTable::INVALID_ID)
+				// Reply would be ignored
+				failLookup(key, out);
+			else
+			{
+				req.setSrc<NodeInfo>(self);
+				req.setDst<uint32>(key);
+
+				// Send lookup request
+				socket.write<Request>(req, req.recipient);
+			}
 		}
 		
 		return out;
 	}
 
-	void LocalNode::leave()
+	void LocalNode::stepLookup(uint32 key, uint32 seq, const NodeInfo & hop)
 	{
-		// Inform successor and predecessor
-		// we are leaving the network
-		Request req{Request::LEAVE};
-		req.sender = self.addr;
-		req.setSrc<NodeInfo>(self);
+		Promise<NodeInfo> out{nullptr};
 
-		// Send to successor
 		{
-			req.recipient = successor.addr;
+			ScopeLock _(&lookupsGuard);
+
+			PendingLookup * lookup = findLookup(key, seq);
+			if (!lookup) return;
+
+			++lookup->numSteps;
+			lookup->next = hop;
+			out = lookup->out;
+		}
+
+		// Lookup state lives in the lookups map,
+		// so that callbacks only capture key and
+		// sequence number, like recursive ones
+		Request req = makeRequest(
+			Request::LOOKUP,
+			hop,
+
+			// * Either follow referral
+			// * or complete lookup
+			[this, key, seq](const Request & res) {
+
+				if (!(res.flags & Request::REFERRAL))
+				{
+					completeLookups(key, res);
+					return;
+				}
+
+				const NodeInfo & next = res.getDst<NodeInfo>();
+				uint32 numSteps;
+
+				{
+					ScopeLock _(&lookupsGuard);
+
+					PendingLookup * lookup = findLookup(key, seq);
+					if (!lookup) return;
+
+					// Don't go in circles
+					if (lookup->numSteps >= 32 || lookup->hasFailed(next))
+					{
+						failLookup(key, lookup->out);
+						return;
+					}
+
+					numSteps = lookup->numSteps;
+				}
+
+				char info[NodeInfo::INFO_STRING_SIZE];
+				printf("LOG: lookup of key 0x%08x referred to %s at step %u\n", key, next.getInfoString(info, sizeof(info)), numSteps);
+
+				stepLookup(key, seq, next);
+			},
+
+			// * Retry step around the hop
+			// * that didn't reply in time
+			[this, key, seq]() {
+
+				NodeInfo hop, next;
+
+				{
+					ScopeLock _(&lookupsGuard);
+
+					PendingLookup * lookup = findLookup(key, seq);
+					if (!lookup) return;
+
+					hop = lookup->next;
+
+					if (lookup->numFailed == PendingLookup::MAX_RETRIES)
+						next = self;
+					else
+					{
+						lookup->failed[lookup->numFailed++] = hop;
+
+						// Find closest preceding finger
+						// among the ones that didn't fail.
+						// Fingers may be updated by the
+						// receive thread meanwhile
+						next = getFinger(0);
+
+						const uint32 first = firstFinger.load(AtomicOrder::Relaxed);
+						for (uint32 i = Math::getP2Index(key - id, 32); i >= first; --i)
+						{
+							const NodeInfo finger = getFinger(i);
+							if (rangeOpen(finger.id, id, key) && !lookup->hasFailed(finger))
+							{
+								next = finger;
+								break;
+							}
+						}
+
+						if (lookup->hasFailed(next)) next = self;
+					}
+
+					if (next.id == id) failLookup(key, lookup->out);
+				}
+
+				checkPeer(hop);
+
+				if (next.id != id)
+				{
+					char info[NodeInfo::INFO_STRING_SIZE];
+					printf("LOG: retrying lookup of key 0x%08x with %s\n", key, next.getInfoString(info, sizeof(info)));
+
+					stepLookup(key, seq, next);
+				}
+			}
+		);
+
+		if (req.id == RequestTable::INVALID_ID)
+			failLookup(key, out);
+		else
+		{
+			req.flags |= Request::ITERATIVE;
+			req.setSrc<NodeInfo>(self);
+			req.setDst<uint32>(key);
+
+			// Send lookup step
 			socket.write<Request>(req, req.recipient);
 		}
+	}
 
-		// Send to predecessor
+	void LocalNode::hedgeLookup(uint32 key, uint32 seq, const NodeInfo & hop, const NodeInfo & alt)
+	{
+		Promise<NodeInfo> out{nullptr};
+
+		{
+			ScopeLock _(&lookupsGuard);
+
+			PendingLookup * lookup = findLookup(key, seq);
+			if (!lookup) return;
+
+			lookup->alt = alt;
+			lookup->reqIds[0] = lookup->reqIds[1] = RequestTable::INVALID_ID;
+			lookup->timerId = RequestTable::INVALID_ID;
+			lookup->numPending = 1;
+			out = lookup->out;
+		}
+
+		Request req = makeHedgedLookup(key, seq, hop, 0);
+		if (req.id == RequestTable::INVALID_ID)
 		{
-			req.recipient = predecessor.addr;
+			// Reply would be ignored
+			failLookup(key, out);
+			return;
+		}
+
+		// Timer-only request, fires the second
+		// request when it expires
+		const uint32 timerId = registerRequest(RequestCallback(nullptr, [this, key, seq]() {
+
+			NodeInfo alt;
+
+			{
+				ScopeLock _(&lookupsGuard);
+
+				// Already resolved
+				PendingLookup * lookup = findLookup(key, seq);
+				if (!lookup) return;
+
+				++lookup->numPending;
+				alt = lookup->alt;
+			}
+
+			Request req = makeHedgedLookup(key, seq, alt, 1);
+			if (req.id == RequestTable::INVALID_ID)
+			{
+				ScopeLock _(&lookupsGuard);
+
+				PendingLookup * lookup = findLookup(key, seq);
+				if (lookup && --lookup->numPending == 0) failLookup(key, lookup->out);
+				return;
+			}
+
+			char info[NodeInfo::INFO_STRING_SIZE];
+			printf("LOG: hedging lookup of key 0x%08x with %s\n", key, alt.getInfoString(info, sizeof(info)));
+
+			// Send second lookup request
 			socket.write<Request>(req, req.recipient);
+		}), getHedgeDelay(hop));
+
+		{
+			ScopeLock _(&lookupsGuard);
+
+			PendingLookup * lookup = findLookup(key, seq);
+			if (lookup) lookup->timerId = timerId;
 		}
+
+		// Send first lookup request
+		socket.write<Request>(req, req.recipient);
 	}
 
-	void LocalNode::stabilize()
+	Request LocalNode::makeHedgedLookup(uint32 key, uint32 seq, const NodeInfo & hop, uint32 i)
 	{
-		// * This op is slightly different from
-		// * the one described in the original
-		// * paper, for we first notify our current
-		// * successor than maybe update it
+		// Error callback needs the request index,
+		// packed with the sequence number so that
+		// captures fit the function inline storage
+		const uint32 tag = (seq << 1) | i;
 
 		Request req = makeRequest(
-			Request::NOTIFY,
-			successor,
-			[this](const Request & req) {
-				
-				const NodeInfo & target = req.getDst<NodeInfo>();
-				if (successor.id == id || rangeOpen(target.id, id, successor.id))
+			Request::LOOKUP,
+			hop,
+
+			// * First reply wins, the other
+			// * request and the timer are dropped
+			[this, key, seq](const Request & res) {
+
+				uint32 timerId, otherId;
+
 				{
-					// Update successor
-					setSuccessor(target);
+					ScopeLock _(&lookupsGuard);
+
+					// Late reply
+					PendingLookup * lookup = findLookup(key, seq);
+					if (!lookup) return;
+
+					timerId = lookup->timerId;
+					otherId = lookup->reqIds[lookup->reqIds[0] == res.id ? 1 : 0];
+				}
+
+				cancelRequest(timerId);
+				cancelRequest(otherId);
+
+				completeLookups(key, res);
+			},
+
+			// * Fail only when both requests fail
+			[this, key, tag]() {
+
+				NodeInfo next;
+
+				{
+					ScopeLock _(&lookupsGuard);
+
+					auto it = lookups.find(key);
+					if (it == lookups.nil() || (it->second.seq << 1) != (tag & ~1U)) return;
+
+					PendingLookup & lookup = it->second;
+					next = tag & 1 ? lookup.alt : lookup.next;
+
+					if (--lookup.numPending == 0) failLookup(key, lookup.out);
+				}
+
+				// Check node
+				checkPeer(next);
+			},
+			getLookupTimeout(hop)
+		);
+
+		if (req.id != RequestTable::INVALID_ID)
+		{
+			ScopeLock _(&lookupsGuard);
+
+			PendingLookup * lookup = findLookup(key, seq);
+			if (lookup) lookup->reqIds[i] = req.id;
+
+			req.setSrc<NodeInfo>(self);
+			req.setDst<uint32>(key);
+		}
+
+		return req;
+	}
+
+	void LocalNode::failLookup(uint32 key, Promise<NodeInfo> out)
+	{
+		// Set an invalid peer, identified
+		// by the wildcard address
+		out.set(NodeInfo{(uint32)-1, Ipv4::any});
+
+		ScopeLock _(&lookupsGuard);
+
+		// A newer lookup may be in flight
+		auto it = lookups.find(key);
+		if (it != lookups.nil() && it->second.out.isReady()) lookups.remove(it);
+	}
+
+	void LocalNode::completeLookups(uint32 key, const Request & res)
+	{
+		// Reply source is the predecessor of
+		// the owner of the resolved range
+		const NodeInfo & owner = res.getDst<NodeInfo>();
+		const NodeInfo & start = res.getSrc<NodeInfo>();
+		const uint32 rangeStart = start.id;
+
+		// Cache resolved range
+		locations.insert(start, owner);
+
+		ScopeLock _(&lookupsGuard);
+
+		auto it = lookups.find(key);
+		if (it != lookups.nil())
+		{
+			it->second.out.set(owner);
+			lookups.remove(it);
+		}
+
+		// Complete other lookups in the same range,
+		// a few at a time to avoid allocations
+		uint32 completed[64];
+		uint32 numCompleted;
+
+		do
+		{
+			numCompleted = 0;
+			for (auto jt = lookups.begin(); jt != lookups.end() && numCompleted < 64; ++jt)
+			{
+				if (rangeOpenClosed(jt->first, rangeStart, owner.id))
+				{
+					jt->second.out.set(owner);
+					completed[numCompleted++] = jt->first;
+				}
+			}
+
+			for (uint32 i = 0; i < numCompleted; ++i)
+				lookups.remove(completed[i]);
+		} while (numCompleted == 64);
+	}
+
+	Promise<void> LocalNode::lookupMany(const uint32 * keys, uint32 numKeys, NodeInfo * results)
+	{
+		SharedPtr<LookupBatch> batch = std::make_shared<LookupBatch>();
+		batch->results = results;
+		batch->numKeys = numKeys;
+		batch->numPending = numKeys;
+		batch->numHops = 0;
+
+		// Keys are unresolved until a reply is received
+		for (uint32 i = 0; i < numKeys; ++i)
+			results[i] = NodeInfo{(uint32)-1, Ipv4::any};
+
+		if (numKeys == 0)
+		{
+			batch->promise.set();
+			return batch->promise;
+		}
+
+		Request req = makeRequest(Request::LOOKUP_MANY, successor);
+		req.flags |= Request::BATCH;
+		req.setSrc<NodeInfo>(self);
+
+		// Register batch, expect one reply unit per key
+		req.id = registerRequest(RequestCallback(
+			
+			// * Write resolved keys
+			[batch](const Request & res) {
+
+				batch->resolve(res.getPayload<LookupResult>(), res.numEntries);
+			},
+
+			// * If some keys are not found, leave
+			// * them unresolved and check the nodes
+			// * we asked for them
+			[this, batch]() {
+
+				batch->fail();
+
+				NodeInfo hops[33];
+				uint32 numHops;
+
+				{
+					ScopeLock _(&batch->guard);
+					for (numHops = 0; numHops < batch->numHops; ++numHops)
+						hops[numHops] = batch->hops[numHops];
+				}
+
+				for (uint32 i = 0; i < numHops; ++i)
+					checkPeer(hops[i]);
+			}
+		), getLookupTimeout(successor), numKeys);
+
+		if (req.id == RequestTable::INVALID_ID)
+		{
+			batch->fail();
+			return batch->promise;
+		}
+
+		LookupKey * entries = reinterpret_cast<LookupKey*>(gMalloc->malloc(numKeys * sizeof(LookupKey)));
+		LookupResult * resolved = reinterpret_cast<LookupResult*>(gMalloc->malloc(numKeys * sizeof(LookupResult)));
+
+		for (uint32 i = 0; i < numKeys; ++i)
+			entries[i] = LookupKey{keys[i], i};
+
+		NodeInfo hops[33];
+		uint32 numHops = 0;
+
+		// Route batch
+		const uint32 numResolved = routeLookups(req, entries, numKeys, resolved, hops, &numHops);
+
+		{
+			// Record next hops for error callback
+			ScopeLock _(&batch->guard);
+			for (uint32 i = 0; i < numHops; ++i)
+				batch->hops[i] = hops[i];
+			
+			batch->numHops = numHops;
+		}
+
+		if (numResolved > 0)
+		{
+			// Consume units of local keys
+			RequestCallback callback;
+			if (acquireRequest(req.id, numResolved, callback))
+				batch->resolve(resolved, numResolved);
+		}
+
+		gMalloc->free(entries);
+		gMalloc->free(resolved);
+
+		return batch->promise;
+	}
+
+	bool LocalNode::openStore(const char * path)
+	{
+		if (!store.open(path))
+		{
+			printf("INFO: could not open store in %s\n", path);
+			return false;
+		}
+
+		printf("INFO: loaded %u keys from %s\n", store.getCount(), path);
+		return true;
+	}
+
+	Promise<bool> LocalNode::put(uint32 key, const void * data, uint32 size)
+	{
+		return sendData(Request::PUT, key, data, size, nullptr, nullptr);
+	}
+
+	Promise<bool> LocalNode::get(uint32 key, void * data, uint32 & size)
+	{
+		return sendData(Request::GET, key, nullptr, 0, data, &size);
+	}
+
+	Promise<bool> LocalNode::remove(uint32 key)
+	{
+		return sendData(Request::REMOVE, key, nullptr, 0, nullptr, nullptr);
+	}
+
+	Promise<bool> LocalNode::sendData(Request::Type type, uint32 key, const void * data, uint32 size, void * out, uint32 * outSize)
+	{
+		Promise<bool> result;
+
+		NodeInfo next = getDataHop(key);
+		uint32 flags = 0;
+
+		if (rangeOpenClosed(key, id, successor.id))
+		{
+			// Successor owns the key, reads are
+			// served by the closest replica
+			flags = Request::LAST_HOP;
+
+			if (type == Request::GET && numReplicas > 0)
+			{
+				next = getNearestReplica(self);
+				if (next.id != successor.id) flags |= Request::REPLICA;
+			}
+		}
+
+		if (size > KeyStore::MAX_VALUE_SIZE)
+			result.set(false);
+		else if (isOwner(key) || next.id == id)
+		{
+			// Key is ours
+			const bool bDone = executeData(type, key, data, size, out, outSize);
+			const bool bWrite = bDone && type != Request::GET;
+
+			if (bWrite && (numReplicas > 0 || store.isPersistent()))
+			{
+				SharedPtr<ReplicatedWrite> write = std::make_shared<ReplicatedWrite>();
+				write->result = result;
+				write->bRemote = false;
+
+				commitData(type, key, data, size, write, numReplicas > 0);
+			}
+			else
+				result.set(bDone);
+		}
+		else
+		{
+			RequestBuffer req;
+			req.header = makeRequest(
+				type,
+				next,
+
+				// * Owner replies with one entry
+				// * on success, and the value read
+				[result, out, outSize](const Request & res) mutable {
+
+					if (out && res.numEntries > 0)
+					{
+						*outSize = Math::min(*outSize, (uint32)res.payloadSize);
+						Memory::memcpy(out, res.getPayload<ubyte>(), *outSize);
+					}
+
+					result.set(res.numEntries > 0);
+				},
+
+				// * Fail and check next hop
+				[this, result, next]() mutable {
+
+					result.set(false);
+					checkPeer(next);
+				},
+				getLookupTimeout(next)
+			);
+
+			if (req.header.id == RequestTable::INVALID_ID)
+				// Reply would be ignored
+				result.set(false);
+			else
+			{
+				req.header.setSrc<NodeInfo>(self);
+				req.header.setDst<uint32>(key);
+				req.header.flags |= flags;
+
+				if (flags & Request::REPLICA)
+				{
+					// Replica falls back to owner
+					// if it lacks the key
+					*reinterpret_cast<NodeInfo*>(req.payload) = successor;
+					req.header.setPayload<NodeInfo>(1);
+				}
+				else
+				{
+					if (size > 0) Memory::memcpy(req.payload, data, size);
+					req.header.setPayload<ubyte>(size);
+				}
+
+				socket.write(&req, req.header.getSize(), req.header.recipient);
+			}
+		}
+
+		return result;
+	}
+
+	bool LocalNode::executeData(Request::Type type, uint32 key, const void * data, uint32 size, void * out, uint32 * outSize)
+	{
+		bool bWritten;
+
+		switch (type)
+		{
+		case Request::PUT:
+			bWritten = store.put(key, data, size);
+			break;
+
+		case Request::GET:
+			return store.get(key, out, *outSize);
+
+		case Request::REMOVE:
+			bWritten = store.remove(key);
+			break;
+
+		default:
+			return false;
+		}
+
+		if (bWritten && onWrite) onWrite();
+		return bWritten;
+	}
+
+	uint32 LocalNode::handOffKeys(const NodeInfo & node, uint32 start, uint32 end, bool bForce, bool bKeep)
+	{
+		Handoff handoff{};
+		handoff.node = node;
+		handoff.flags = bForce ? Request::HANDOFF : (node.id == successor.id ? Request::LAST_HOP : 0);
+		handoff.bKeep = bKeep;
+
+		uint32 numKeys;
+
+		{
+			ScopeLock _(&handoffsGuard);
+
+			// Values are read again when sent,
+			// only keys are queued
+			numKeys = store.visit([start, end](uint32 key) {
+
+				return start == end || rangeOpenClosed(key, start, end);
+			}, [this, &handoff](uint32 key, const ubyte*, uint32, uint32) {
+
+				handoff.key = key;
+				handoffs.push(handoff);
+			});
+		}
+
+		sendHandoffs();
+		return numKeys;
+	}
+
+	void LocalNode::sendHandoffs()
+	{
+		ScopeLock _(&handoffsGuard);
+
+		RequestBuffer req;
+
+		while (numFreeHandoffs > 0 && !handoffs.isEmpty())
+		{
+			const uint32 slot = freeHandoffs[numFreeHandoffs - 1];
+			Handoff & handoff = sentHandoffs[slot];
+
+			// Most recently queued first
+			handoff = handoffs[handoffs.getCount() - 1];
+
+			// Read checksum first, if value changes
+			// before it is read it won't match
+			uint32 size = KeyStore::MAX_VALUE_SIZE;
+			if (!store.getChecksum(handoff.key, handoff.checksum) || !store.get(handoff.key, req.payload, size))
+			{
+				// Key was removed meanwhile
+				handoffs.removeAt(handoffs.getCount() - 1);
+				continue;
+			}
+
+			req.header = makeRequest(
+				Request::PUT,
+				handoff.node,
+				[this, slot](const Request & res) {
+
+					finishHandoff(slot, res.numEntries > 0);
+				},
+				[this, slot]() {
+
+					finishHandoff(slot, false);
+				}
+			);
+
+			// Request table is full, try
+			// again on next check
+			if (req.header.id == RequestTable::INVALID_ID) break;
+
+			handoffs.removeAt(handoffs.getCount() - 1);
+			--numFreeHandoffs;
+			++handoff.numAttempts;
+
+			req.header.flags |= handoff.flags;
+			req.header.setSrc<NodeInfo>(self);
+			req.header.setDst<uint32>(handoff.key);
+			req.header.setPayload<ubyte>(size);
+
+			socket.write(&req, req.header.getSize(), req.header.recipient);
+		}
+
+		// Done leaving, nothing left to send
+		if (bLeaving && handoffs.isEmpty() && numFreeHandoffs == HANDOFF_WINDOW)
+		{
+			bLeaving = false;
+			leaving.set(numHandedOff);
+		}
+	}
+
+	void LocalNode::finishHandoff(uint32 slot, bool bAcked)
+	{
+		{
+			ScopeLock _(&handoffsGuard);
+
+			const Handoff & handoff = sentHandoffs[slot];
+			freeHandoffs[numFreeHandoffs++] = slot;
+
+			if (bAcked)
+			{
+				++numHandedOff;
+
+				// Keep key if it was written again
+				// after it was sent, the new value
+				// may not have reached node
+				if (!handoff.bKeep && store.remove(handoff.key, handoff.checksum) && onWrite) onWrite();
+			}
+			else if (handoff.numAttempts < MAX_HANDOFF_ATTEMPTS)
+				handoffs.push(handoff);
+			else
+				printf("LOG: could not hand off key 0x%08x to %s\n", handoff.key, *handoff.node.getInfoString());
+		}
+
+		sendHandoffs();
+	}
+
+	void LocalNode::commitData(Request::Type type, uint32 key, const void * data, uint32 size, SharedPtr<ReplicatedWrite> write, bool bReplicate)
+	{
+		write->bSynced = !store.isPersistent();
+
+		if (bReplicate)
+			replicateData(type, key, data, size, write);
+		else
+		{
+			write->quorum = 0;
+			write->numAcks = 0;
+			write->numPending = 0;
+			write->bDone = false;
+
+			write->update(socket, 0, 0);
+		}
+
+		if (!write->bSynced)
+		{
+			{
+				// Queued once its counters are set,
+				// the store task may sync it at once
+				ScopeLock _(&syncsGuard);
+
+				write->ticket = store.getWriteTicket();
+				if (syncsTail) syncsTail->nextSync = write;
+				else syncsHead = write;
+				syncsTail = write.get();
+			}
+
+			if (onWrite) onWrite();
+		}
+	}
+
+	void LocalNode::replicateData(Request::Type type, uint32 key, const void * data, uint32 size, SharedPtr<ReplicatedWrite> write)
+	{
+		// Replicas are the first successors
+		NodeInfo replicas[MAX_SUCCESSORS];
+		const uint32 numTargets = Math::min(getSuccessorList(replicas), numReplicas);
+
+		write->quorum = Math::min(writeQuorum, numTargets);
+		write->numAcks = 0;
+		write->numPending = numTargets;
+		write->bDone = false;
+
+		// Complete right away if no ack is needed
+		write->update(socket, 0, 0);
+
+		for (uint32 i = 0; i < numTargets; ++i)
+		{
+			RequestBuffer req;
+			req.header = makeRequest(
+				type,
+				replicas[i],
+
+				// * Any reply is an ack
+				[this, write](const Request&) {
+
+					write->update(socket, 1, 1);
+				},
+
+				// * Replica is lost
+				[this, write]() {
+
+					write->update(socket, 0, 1);
+				}
+			);
+
+			if (req.header.id == RequestTable::INVALID_ID)
+			{
+				write->update(socket, 0, 1);
+				continue;
+			}
+
+			req.header.flags |= Request::REPLICA;
+			req.header.setSrc<NodeInfo>(self);
+			req.header.setDst<uint32>(key);
+
+			if (size > 0) Memory::memcpy(req.payload, data, size);
+			req.header.setPayload<ubyte>(size);
+
+			socket.write(&req, req.header.getSize(), req.header.recipient);
+		}
+	}
+
+	NodeInfo LocalNode::getNearestReplica(const NodeInfo & node)
+	{
+		// Successor owns the key, the
+		// following ones hold replicas
+		NodeInfo list[MAX_SUCCESSORS];
+		const uint32 n = Math::min(getSuccessorList(list), numReplicas + 1);
+		if (n == 0) return successor;
+
+		// Our own proximity is measured, that
+		// of other nodes is predicted from
+		// network coordinates
+		auto getDistance = [this, &node](const NodeInfo & replica) -> float32 {
+
+			if (node.id == id) return getProximity(replica);
+			if (isTrusted(node.coord) && isTrusted(replica.coord)) return node.coord.getDistance(replica.coord);
+
+			return 3.4e38f;
+		};
+
+		uint32 nearest = 0;
+		float32 minDistance = getDistance(list[0]);
+
+		for (uint32 i = 1; i < n; ++i)
+		{
+			// Node holds a replica itself
+			if (list[i].id == node.id) return list[i];
+
+			const float32 distance = getDistance(list[i]);
+			if (distance < minDistance)
+			{
+				nearest = i;
+				minDistance = distance;
+			}
+		}
+
+		return list[nearest];
+	}
+
+	void LocalNode::sendSync(const NodeInfo & node, const RangeDigest & range)
+	{
+		// Collect keys in range
+		uint32 numKeys = 0, maxKeys = 64;
+		SyncEntry * entries = reinterpret_cast<SyncEntry*>(gMalloc->malloc(maxKeys * sizeof(SyncEntry)));
+
+		store.visit([&range](uint32 key) {
+
+			return rangeOpenClosed(key, range.start, range.end);
+		}, [&](uint32 key, const ubyte*, uint32, uint32 checksum) {
+
+			if (numKeys == maxKeys) entries = reinterpret_cast<SyncEntry*>(gMalloc->realloc(entries, (maxKeys *= 2) * sizeof(SyncEntry)));
+			entries[numKeys++] = SyncEntry{key, checksum};
+		});
+
+		// Sort in ring order from range start,
+		// so that each datagram covers a sub
+		// range of keys
+		const uint32 start = range.start;
+		Container::sort(entries, entries + numKeys, [start](const SyncEntry & a, const SyncEntry & b) -> int32 {
+
+			const uint32 x = a.key - start, y = b.key - start;
+			return x < y ? -1 : (x > y ? 1 : 0);
+		});
+
+		RequestBuffer req;
+		req.header = makeRequest(Request::SYNC, node);
+		req.header.setSrc<NodeInfo>(self);
+
+		const uint32 maxEntries = Request::MAX_PAYLOAD_SIZE / sizeof(SyncEntry);
+		uint32 first = 0;
+		uint32 subStart = range.start;
+
+		do
+		{
+			const uint32 n = Math::min(numKeys - first, maxEntries);
+			const bool bLast = first + n == numKeys;
+
+			// Last datagram ends at range end
+			const uint32 subEnd = bLast ? range.end : entries[first + n - 1].key;
+
+			req.header.setDst<RangeDigest>(RangeDigest{subStart, subEnd, n, 0U});
+			Memory::memcpy(req.payload, entries + first, n * sizeof(SyncEntry));
+			req.header.setPayload<SyncEntry>(n);
+
+			socket.write(&req, req.header.getSize(), req.header.recipient);
+
+			first += n;
+			subStart = subEnd;
+		} while (first < numKeys);
+
+		gMalloc->free(entries);
+	}
+
+	Promise<uint32> LocalNode::leave()
+	{
+		{
+			ScopeLock _(&handoffsGuard);
+
+			leaving = Promise<uint32>{};
+			numHandedOff = 0;
+			bLeaving = true;
+		}
+
+		// Successor takes over our range
+		if (successor.id != id)
+		{
+			const uint32 numKeys = handOffKeys(successor, id, id);
+			if (numKeys > 0) printf("LOG: handing off %u keys to %s\n", numKeys, *successor.getInfoString());
+		}
+
+		sendLeave();
+
+		// Complete now if there was
+		// nothing to hand off
+		sendHandoffs();
+
+		return leaving;
+	}
+
+	void LocalNode::sendLeave()
+	{
+		// Inform successor and predecessor
+		// we are leaving the network, hand
+		// off our predecessor and successor
+		// list so that they can splice the
+		// ring without further lookups
+		RequestBuffer req;
+		req.header = makeRequest(Request::LEAVE, successor);
+		req.header.setSrc<NodeInfo>(self);
+		req.header.setDst<NodeInfo>(predecessor);
+		req.header.setPayload<NodeInfo>(getSuccessorList(reinterpret_cast<NodeInfo*>(req.payload)));
+
+		// Send to successor
+		{
+			req.header.recipient = successor.addr;
+			req.header.target = successor.id;
+			socket.write(&req, req.header.getSize(), req.header.recipient);
+		}
+
+		// Send to predecessor
+		{
+			req.header.recipient = predecessor.addr;
+			req.header.target = predecessor.id;
+			socket.write(&req, req.header.getSize(), req.header.recipient);
+		}
+	}
+
+	void LocalNode::stabilize()
+	{
+		// * This op is slightly different from
+		// * the one described in the original
+		// * paper, for we first notify our current
+		// * successor than maybe update it
+
+		RequestBuffer req;
+		req.header = makeRequest(
+			Request::NOTIFY,
+			successor,
+			[this](const Request & req) {
+				
+				const NodeInfo & target = req.getDst<NodeInfo>();
+				if (successor.id == id || rangeOpen(target.id, id, successor.id))
+				{
+					// Update successor
+					setSuccessor(target);
+
+					printf("LOG: new successor is %s\n", *successor.getInfoString());
+				}
+
+				// Replier sends its own successor list
+				const uint32 n = Math::min(req.numEntries, req.payloadSize / (uint32)sizeof(NodeInfo));
+				updateSuccessorList(req.getSrc<NodeInfo>(), req.getPayload<NodeInfo>(), n);
+
+				// Followed by its load
+				if (req.payloadSize >= n * sizeof(NodeInfo) + sizeof(float32) && req.getSrc<NodeInfo>().id == successor.id)
+					successorLoad = *reinterpret_cast<const float32*>(req.getPayload<NodeInfo>() + n);
+			}
+		);
+		req.header.setSrc<NodeInfo>(self);
+
+		if (numReplicas > 0 && predecessor.id != id && successor.id != id)
+		{
+			// Successor replicates our range and
+			// the ranges we replicate but the last
+			// one, piggyback their digests
+			RangeDigest * ranges = reinterpret_cast<RangeDigest*>(req.payload);
+			uint32 n = 0;
+
+			ranges[n++] = RangeDigest{predecessor.id, id, 0U, 0U};
+
+			{
+				ScopeLock _(&replicasGuard);
+				for (uint32 i = 0; i < numReplicaRanges && n < numReplicas; ++i)
+					ranges[n++] = replicaRanges[i];
+			}
+
+			store.getDigests(ranges, n);
+			req.header.setPayload<RangeDigest>(n);
+		}
+
+		// Send notify
+		socket.write(&req, req.header.getSize(), req.header.recipient);
+	}
+
+	void LocalNode::fixFingers()
+	{
+		const float64 now = getTime();
+		if (now < nextFingersTime) return;
+
+		// Refresh more often while fingers
+		// keep changing, back off when stable
+		if (numFingerChanges.exchange(0U) > 0)
+			fingersPeriod = Math::max(fingersPeriod * 0.5f, (float32)MIN_FINGERS_PERIOD);
+		else
+			fingersPeriod = Math::min(fingersPeriod * 2.f, (float32)MAX_FINGERS_PERIOD);
+
+		nextFingersTime = now + fingersPeriod;
+
+		refreshFingers();
+	}
+
+	void LocalNode::refreshFingers()
+	{
+		// Alone in the ring
+		if (successor.id == id) return;
+
+		// Range covered by the last lookup sent,
+		// starting with the successor range
+		uint32 start = id;
+		uint32 end = successor.id;
+
+		LocationCache::Range range{self, self, 0.0};
+
+		// Drop fingers below the expected
+		// successor gap, successor owns them
+		for (uint32 i = 1; i < firstFinger; ++i)
+			if (fingers[i].id != id) setFinger(self, i);
+
+		for (uint32 i = firstFinger; i < 32; ++i)
+		{
+			const uint32 key = id + (1U << i);
+
+			if (rangeOpenClosed(key, id, successor.id))
+				updateFinger(successor, i);
+			else if (rangeOpenClosed(key, start, end))
+				// Reply of that lookup sets it
+				continue;
+			else if (locations.find(key, range) && locations.isFresh(range))
+				// Range resolved recently
+				updateFinger(range.owner, i);
+			else
+			{
+				// Assume current finger is right,
+				// following keys in its range are
+				// resolved by the same lookup
+				start = key;
+				end = fingers[i].id == id ? key : fingers[i].id;
+
+				fixFinger(i);
+			}
+		}
+	}
+
+	void LocalNode::fixFinger(uint32 i)
+	{
+		const uint32 key = id + (1U << i);
+
+		/**
+		 * Here there is a piece of code
+		 * copied from @ref lookup
+		 */
+		if (rangeOpenClosed(key, id, successor.id))
+			updateFinger(successor, i);
+		else
+		{
+			// Update next finger
+			const NodeInfo & next = findSuccessor(key);
+
+			Request req = makeRequest(
+				Request::LOOKUP,
+				next,
+				[this, i, key](const Request & req) {
+
+					const NodeInfo & owner = req.getDst<NodeInfo>();
+
+					// Owner also owns the following
+					// keys that precede it
+					updateFinger(owner, i);
+					for (uint32 j = i + 1; j < 32 && rangeOpenClosed(id + (1U << j), key, owner.id); ++j)
+						updateFinger(owner, j);
+				},
+				// * checkPeer(next) on error
+				nullptr,
+				getLookupTimeout(next)
+			);
+			req.setSrc<NodeInfo>(self);
+			req.setDst<uint32>(key);
+
+			// Send lookup request
+			socket.write<Request>(req, req.recipient);
+		}
+	}
+
+	void LocalNode::updateFinger(const NodeInfo & node, uint32 i)
+	{
+		const uint32 prev = fingers[i].id;
+
+		if (isInSlot(node, i))
+		{
+			addCandidate(node, i);
+
+			// Any node in the slot will do,
+			// pick the closest one
+			if (isInSlot(fingers[i], i)) selectFinger(i);
+			else setFinger(node, i);
+		}
+		else if (prev != node.id)
+			// No node in slot
+			setFinger(node, i);
+
+		if (fingers[i].id == prev) return;
+
+		++numFingerChanges;
+
+		// Called on replies, logging
+		// must not allocate
+		char info[NodeInfo::INFO_STRING_SIZE];
+		printf("LOG: updating finger #%u with %s\n", i, fingers[i].getInfoString(info, sizeof(info)));
+	}
+
+	void LocalNode::learnPeer(const NodeInfo & peer)
+	{
+		// Successor is maintained by stabilize
+		if (peer.id == id || rangeOpenClosed(peer.id, id, successor.id)) return;
+
+		// Called for every request, logging
+		// must not allocate
+		char info[NodeInfo::INFO_STRING_SIZE];
+
+		for (uint32 i = firstFinger; i < 32; ++i)
+		{
+			const uint32 key = id + (1U << i);
+
+			if (isInSlot(peer, i))
+			{
+				addCandidate(peer, i);
+
+				// Finger is not set, or beyond slot
+				if (!isInSlot(fingers[i], i))
+				{
+					setFinger(peer, i);
+
+					printf("LOG: learned finger #%u from traffic, %s\n", i, peer.getInfoString(info, sizeof(info)));
+				}
+			}
+			else if (rangeClosedOpen(peer.id, key, fingers[i].id))
+			{
+				// Peer succeeds finger key and precedes
+				// current finger. An unset finger is
+				// ourself, the range ends at our id
+				setFinger(peer, i);
+
+				printf("LOG: learned finger #%u from traffic, %s\n", i, peer.getInfoString(info, sizeof(info)));
+			}
+			else if (fingers[i].id == peer.id)
+				// Refresh advertised coordinate
+				setFinger(peer, i);
+		}
+	}
+
+	void LocalNode::addCandidate(const NodeInfo & node, uint32 i)
+	{
+		const float32 rtt = rtts.getRtt(node.addr);
+
+		{
+			ScopeLock _(&candidatesGuard);
+
+			// Finger is not meaningful
+			CandidateSet * set = getCandidates(i);
+			if (!set) return;
+
+			NodeInfo * slot = set->nodes;
+			uint32 & n = set->count;
+
+			for (uint32 j = 0; j < n; ++j)
+			{
+				if (slot[j].id == node.id)
+				{
+					// Node may have moved
+					slot[j] = node;
+					return;
+				}
+			}
+
+			if (n < MAX_CANDIDATES)
+				slot[n++] = node;
+			else
+			{
+				// Replace slowest candidate, unless
+				// new node is not known to be faster
+				uint32 worst = 0;
+				float32 worstRtt = 0.f;
+
+				for (uint32 j = 0; j < n; ++j)
+				{
+					const float32 candidateRtt = getProximity(slot[j]);
+					if (candidateRtt > worstRtt) worst = j, worstRtt = candidateRtt;
+				}
+
+				if (worstRtt < rtts.getMaxTimeout() && (rtt <= 0.f || rtt >= worstRtt)) return;
+
+				slot[worst] = node;
+			}
+		}
+
+		// Measured or predicted well enough
+		if (rtt > 0.f || canPredictRtt(node)) return;
+
+		// Probe candidate, reply gives
+		// a first RTT sample
+		Request req = makeRequest(
+			Request::CHECK,
+			node,
+			[this, i](const Request & res) {
+
+				selectFinger(i);
+			},
+			[this, node]() {
+
+				removeCandidate(node);
+			}
+		);
+		req.setSrc<NodeInfo>(self);
+
+		socket.write<Request>(req, req.recipient);
+	}
+
+	void LocalNode::removeCandidate(const NodeInfo & node)
+	{
+		ScopeLock _(&candidatesGuard);
+
+		for (uint32 i = 0; i < numCandidateSets; ++i)
+		{
+			NodeInfo * slot = candidates[i].nodes;
+			uint32 & n = candidates[i].count;
+
+			for (uint32 j = 0; j < n; ++j)
+				if (slot[j].id == node.id) slot[j--] = slot[--n];
+		}
+	}
+
+	bool LocalNode::selectFinger(uint32 i)
+	{
+		// Finger is not set, or no
+		// node falls in its slot
+		if (!isInSlot(fingers[i], i)) return false;
+
+		NodeInfo best = fingers[i];
+		float32 bestRtt = getProximity(best);
+
+		{
+			ScopeLock _(&candidatesGuard);
+
+			const CandidateSet * set = getCandidates(i);
+			for (uint32 j = 0; set && j < set->count; ++j)
+			{
+				const float32 rtt = getProximity(set->nodes[j]);
+				if (rtt < bestRtt) best = set->nodes[j], bestRtt = rtt;
+			}
+		}
+
+		if (best.id == fingers[i].id) return false;
+
+		setFinger(best, i);
+
+		char info[NodeInfo::INFO_STRING_SIZE];
+		printf("LOG: finger #%u switched to %s, rtt = %.2f ms\n", i, best.getInfoString(info, sizeof(info)), bestRtt * 1000.f);
+		return true;
+	}
+
+	float32 LocalNode::getProximity(const NodeInfo & node)
+	{
+		const float32 rtt = rtts.getRtt(node.addr);
+		if (rtt > 0.f) return rtt;
+
+		// Fallback to predicted RTT, an unmeasured
+		// node never ranks ahead of a measured one
+		return canPredictRtt(node) ? predictRtt(node) : rtts.getMaxTimeout();
+	}
+
+	void LocalNode::seedFingers(const NodeInfo * nodes, uint32 numNodes)
+	{
+		for (uint32 i = firstFinger; i < 32; ++i)
+		{
+			const uint32 key = id + (1U << i);
+			if (rangeOpenClosed(key, id, successor.id)) continue;
+
+			// Best guess is the first known
+			// node that follows the key
+			NodeInfo best = successor;
+			for (uint32 j = 0; j < numNodes; ++j)
+				if (nodes[j].id != id && nodes[j].id - key < best.id - key) best = nodes[j];
+
+			setFinger(best, i);
+		}
+
+		printf("LOG: seeded finger table with %u nodes\n", numNodes);
+
+		// Verify all fingers at once, routing
+		// through the seeded table
+		refreshFingers();
+	}
+
+	uint32 LocalNode::getSuccessorList(NodeInfo * list)
+	{
+		ScopeLock _(&successorsGuard);
+
+		if (successor.id == id) return 0;
+
+		list[0] = successor;
+		for (uint32 i = 0; i < numSuccessors; ++i)
+			list[i + 1] = successors[i];
+		
+		return numSuccessors + 1;
+	}
+
+	void LocalNode::updateSuccessorList(const NodeInfo & node, const NodeInfo * list, uint32 n)
+	{
+		ScopeLock _(&successorsGuard);
+
+		// Node is no longer our successor
+		if (node.id != successor.id && !rangeOpen(successor.id, id, node.id)) return;
+
+		uint32 numNodes = 0;
+
+		// Successor changed, node now follows it
+		if (node.id != successor.id) successors[numNodes++] = node;
+
+		for (uint32 i = 0; i < n && numNodes < MAX_SUCCESSORS - 1; ++i)
+		{
+			// List wrapped around the ring
+			if (list[i].id == id || list[i].id == successor.id) break;
+
+			successors[numNodes++] = list[i];
+		}
+
+		numSuccessors = numNodes;
+
+		estimateRingSize();
+	}
+
+	void LocalNode::estimateRingSize()
+	{
+		// Alone in the ring
+		if (successor.id == id)
+		{
+			ringSize.store(1U, AtomicOrder::Relaxed);
+			firstFinger.store(1U, AtomicOrder::Relaxed);
+			resizeCandidates();
+			return;
+		}
+
+		// Successor list covers numSuccessors + 1
+		// gaps, N nodes split the ring in N gaps
+		const NodeInfo & last = numSuccessors > 0 ? successors[numSuccessors - 1] : successor;
+		const float64 span = (float64)(uint32)(last.id - id);
+		const float32 estimate = (float32)((numSuccessors + 1) * 4294967296.0 / span);
+
+		// Smooth out noise of small lists
+		const float32 prevSize = (float32)ringSize.load(AtomicOrder::Relaxed);
+		const float32 size = Math::max(prevSize > 1.f ? prevSize * 0.75f + estimate * 0.25f : estimate, 1.f);
+		ringSize.store((uint32)Math::min(size + 0.5f, 4294967295.f), AtomicOrder::Relaxed);
+
+		// Keys of lower fingers most likely
+		// fall in the successor range
+		const uint32 gapIndex = Math::getP2Index((uint32)Math::min(4294967295.0, 4294967296.0 / size));
+		firstFinger.store(gapIndex > FINGERS_MARGIN ? gapIndex - FINGERS_MARGIN : 1U, AtomicOrder::Relaxed);
+
+		resizeCandidates();
+	}
+
+	void LocalNode::resizeCandidates()
+	{
+		const uint32 numSets = 32U - firstFinger.load(AtomicOrder::Relaxed);
+		if (numSets == numCandidateSets) return;
+
+		ScopeLock _(&candidatesGuard);
+
+		// Sets start from the last finger, so
+		// that kept ones don't move
+		candidates = reinterpret_cast<CandidateSet*>(gMalloc->realloc(candidates, numSets * sizeof(CandidateSet)));
+		for (uint32 i = numCandidateSets; i < numSets; ++i)
+			candidates[i].count = 0;
+
+		numCandidateSets = numSets;
+	}
+
+	void LocalNode::compactStore()
+	{
+		uint32 numMoved;
+		if (store.compact(numMoved)) printf("LOG: compacted store segment, moved %u records\n", numMoved);
+	}
+
+	void LocalNode::flushStore()
+	{
+		store.flush();
+
+		// Tickets grow along the queue, stop
+		// at the first write not synced yet
+		for (;;)
+		{
+			SharedPtr<ReplicatedWrite> write;
+
+			{
+				ScopeLock _(&syncsGuard);
+				if (!syncsHead || !store.isSynced(syncsHead->ticket)) break;
+
+				write = syncsHead;
+				syncsHead = ::move(write->nextSync);
+				if (!syncsHead) syncsTail = nullptr;
+			}
+
+			write->sync(socket);
+		}
+	}
+
+	bool LocalNode::hasPendingWrites()
+	{
+		ScopeLock _(&syncsGuard);
+		return syncsHead || !store.isSynced(store.getWriteTicket());
+	}
+
+	void LocalNode::balanceLoad()
+	{
+		const float64 now = getTime();
+		if (now - lastLoadTime < LOAD_PERIOD) return;
+
+		// Sample request rate
+		const float32 rate = lastLoadTime > 0.0 ? (load.numRequests - lastNumRequests) / (now - lastLoadTime) : 0.f;
+		load.rate = load.rate > 0.f ? load.rate * 0.5f + rate * 0.5f : rate;
+
+		load.numKeys = store.getCount();
+
+		lastNumRequests = load.numRequests;
+		lastLoadTime = now;
+
+		if (!bLoadBalancing || successor.id == id || predecessor.id == id) return;
+		if (now - lastMoveTime < MOVE_COOLDOWN || load.rate < MIN_MOVE_LOAD || load.rate < successorLoad * MAX_LOAD_RATIO) return;
+
+		// Assume load is spread evenly over our
+		// range, hand off the excess to successor
+		const uint32 range = id - predecessor.id;
+		const float32 shed = (load.rate - successorLoad) / (2.f * load.rate);
+		const uint32 newId = id - (uint32)(range * shed);
+
+		if (newId == id || newId == predecessor.id) return;
+
+		printf("INFO: node %s overloaded, %.1f vs %.1f req/s\n", *self.getInfoString(), load.rate, successorLoad);
+
+		lastMoveTime = now;
+		moveTo(newId);
+	}
+
+	void LocalNode::moveTo(uint32 newId)
+	{
+		const NodeInfo next = successor;
+
+		// Successor takes over (newId, id], we
+		// keep the rest of our range. When we
+		// join again it finds nothing of ours
+		// to hand back but replicas
+		const uint32 numKeys = handOffKeys(successor, newId, id);
+		if (numKeys > 0) printf("LOG: handing off %u keys to %s\n", numKeys, *successor.getInfoString());
+
+		// Neighbours splice the ring
+		// around our old position
+		sendLeave();
+		locations.invalidate(self);
+
+		// Lookups and writes read our id on
+		// other threads, never let them see
+		// a torn value
+		prevId = id;
+		PlatformAtomics::exchange(&id, newId);
+
+		// Reset routing state
+		{
+			ScopeLock _(&successorsGuard);
+			numSuccessors = 0;
+		}
+
+		{
+			ScopeLock _(&candidatesGuard);
+			for (uint32 i = 0; i < numCandidateSets; ++i)
+				candidates[i].count = 0;
+		}
+
+		setPredecessor(self);
+		for (uint32 i = 0; i < 32; ++i)
+			setFinger(self, i);
+		
+		successorLoad = 0.f;
+
+		// Refresh fingers as soon as
+		// we have a successor
+		fingersPeriod = (float32)MIN_FINGERS_PERIOD;
+		nextFingersTime = 0.0;
+
+		printf("INFO: moved node to %s\n", *self.getInfoString());
+
+		// Old successor takes over the range
+		// we left and follows our new id
+		rejoin(next, 3U);
+	}
+
+	void LocalNode::rejoin(const NodeInfo & peer, uint32 numAttempts)
+	{
+		Request req = makeRequest(
+			Request::LOOKUP,
+			peer,
+			[this](const Request & res) {
+
+				setSuccessor(res.getDst<NodeInfo>());
 
-					printf("LOG: new successor is %s\n", *successor.getInfoString());
-				}
+				printf("INFO: connected with successor %s\n", *successor.getInfoString());
+
+				// Successor list and fingers are
+				// rebuilt by the receive task
+				stabilize();
+			},
+			[this, peer, numAttempts]() {
+
+				if (numAttempts > 1) rejoin(peer, numAttempts - 1);
+				else printf("LOG: could not rejoin ring through %s\n", *peer.getInfoString());
 			}
 		);
 		req.setSrc<NodeInfo>(self);
+		req.setDst<uint32>(id);
 
-		// Send notify
 		socket.write<Request>(req, req.recipient);
 	}
 
-	void LocalNode::fixFingers()
+	void LocalNode::removePeer(const NodeInfo & peer)
 	{
-		const uint32 key = id + (1U << nextFinger);
-		const uint32 i = nextFinger;
+		if (peer.id == predecessor.id)
+			// Set predecessor to NIL
+			setPredecessor(self);
+		
+		NodeInfo next = self;
 
-		/**
-		 * Here there is a piece of code
-		 * copied from @ref lookup
-		 */
-		if (rangeOpenClosed(key, id, successor.id))
-		{
-			// Update finger
-			setFinger(successor, i);
-			
-			printf("LOG: updating finger #%u with %s\n", i, *fingers[i].getInfoString());
-		}
-		else
 		{
-			// Update next finger
-			const NodeInfo & next = findSuccessor(key);
-
-			Request req = makeRequest(
-				Request::LOOKUP,
-				next,
-				[this, i](const Request & req) {
+			ScopeLock _(&successorsGuard);
 
-					// Update finger
-					setFinger(req.getDst<NodeInfo>(), i);
+			// Drop peer from successor list
+			uint32 numNodes = 0;
+			for (uint32 i = 0; i < numSuccessors; ++i)
+				if (successors[i].id != peer.id) successors[numNodes++] = successors[i];
+			
+			numSuccessors = numNodes;
 
-					printf("LOG: updating finger #%u with %s\n", i, *fingers[i].getInfoString());
-				}
-				// * checkPeer(next) on error
-			);
-			req.setSrc<NodeInfo>(self);
-			req.setDst<uint32>(key);
+			if (peer.id == successor.id && numSuccessors > 0)
+			{
+				// Promote next node in list
+				next = successors[0];
+				Memory::memmove(successors, successors + 1, --numSuccessors * sizeof(NodeInfo));
 
-			// Send lookup request
-			socket.write<Request>(req, req.recipient);
+				setSuccessor(next);
+			}
 		}
 
-		// Next finger
-		nextFinger = ++nextFinger == 32U ? 1U : nextFinger;
-	}
+		if (next.id != id)
+		{
+			printf("LOG: new successor is %s\n", *next.getInfoString());
 
-	void LocalNode::removePeer(const NodeInfo & peer)
-	{
-		if (peer.id == predecessor.id)
-			// Set predecessor to NIL
-			setPredecessor(self);
-		
-		if (peer.id == successor.id)
+			// Notify new successor so that it
+			// adopts us as predecessor now
+			stabilize();
+		}
+		else if (peer.id == successor.id)
 		{
+			// No node left in successor list
 			// ! I don't think this actually works
 
 			// Reset successor temporarily
@@ -271,8 +2114,11 @@ namespace Chord
 					setSuccessor(req.getDst<NodeInfo>());
 
 					printf("LOG: new successor is %s\n", *successor.getInfoString());
-				}
+				},
+				nullptr,
+				getLookupTimeout(predecessor)
 			);
+			req.setSrc<NodeInfo>(self);
 			req.setDst<uint32>(id + 1);
 
 			socket.write<Request>(req, req.recipient);
@@ -283,6 +2129,11 @@ namespace Chord
 				// Unset finger
 				setFinger(self, i);
 		
+		removeCandidate(peer);
+
+		// Forget ranges that refer to peer
+		locations.invalidate(peer);
+
 		printf("LOG: removed node %s from local view\n", *peer.getInfoString());
 	}
 
@@ -309,87 +2160,248 @@ namespace Chord
 		checkPeer(predecessor);
 	}
 
-	void LocalNode::checkRequests(float32 dt)
+	void LocalNode::checkRequests()
+	{
+		// Collect expired deadlines
+		timeouts.advance();
+
+		uint64 key;
+		while (timeouts.popExpired(key))
+		{
+			const uint32 reqId = key;
+			RequestCallback callback;
+
+			if (!requests.remove(reqId, callback))
+			{
+				// Slot is busy, check again
+				// on next tick
+				if (requests.isBusy(reqId)) timeouts.arm(requests.getIndex(reqId), reqId, timeouts.getResolution());
+
+				// Reply may have been received in the meantime
+				continue;
+			}
+
+			printf("LOG: no reply received for request with id %08x\n", reqId);
+
+			// Be more patient with the recipient
+			// until it replies again
+			if (callback.time > 0.0) rtts.backoff(callback.recipient.addr);
+
+			// Execute error callback, or check
+			// the peer that didn't reply
+			if (callback.onError) callback.onError();
+			else if (callback.time > 0.0) checkPeer(callback.recipient);
+		}
+
+		// Resume handoffs held back
+		// by a full request table
+		sendHandoffs();
+	}
+
+	uint32 LocalNode::routeLookups(const Request & req, const LookupKey * keys, uint32 numKeys, LookupResult * resolved, NodeInfo * hops, uint32 * numHops)
 	{
-		// Lock all callbacks
-		ScopeLock _(&callbacksGuard);
+		enum : uint8 { RESOLVED = 0xff };
+
+		// Distinct next hops, at most one per finger
+		NodeInfo nextHops[33];
+		uint32 numNextHops = 0;
+		uint32 numResolved = 0;
+
+		// Next hop of each key, relayed
+		// batches fit on the stack
+		uint8 stackHops[Request::MAX_PAYLOAD_SIZE / sizeof(LookupKey)];
+		uint8 * keyHops = numKeys <= sizeof(stackHops) ? stackHops : reinterpret_cast<uint8*>(gMalloc->malloc(numKeys));
+
+		for (uint32 i = 0; i < numKeys; ++i)
+		{
+			const uint32 key = keys[i].key;
+			keyHops[i] = RESOLVED;
+
+			// If successor is succ(key)
+			if (rangeOpenClosed(key, id, successor.id))
+				resolved[numResolved++] = LookupResult{keys[i].index, successor};
+			else
+			{
+				// Find closest preceding node
+				const NodeInfo & next = findSuccessor(key);
+
+				// Break infinite loop
+				if (next.id == id)
+					resolved[numResolved++] = LookupResult{keys[i].index, self};
+				else
+				{
+					uint32 hop = 0;
+					while (hop < numNextHops && nextHops[hop].id != next.id) ++hop;
+					if (hop == numNextHops) nextHops[numNextHops++] = next;
+
+					keyHops[i] = hop;
+				}
+			}
+		}
+
+		// Forward each group in as few datagrams as possible
+		const uint32 maxKeys = Request::MAX_PAYLOAD_SIZE / sizeof(LookupKey);
+
+		RequestBuffer fwd;
+		fwd.header = req;
+		fwd.header.sender = self.addr;
 
-		for (auto it = callbacks.begin(); it != callbacks.end(); ++it)
+		LookupKey * entries = reinterpret_cast<LookupKey*>(fwd.payload);
+
+		for (uint32 hop = 0; hop < numNextHops; ++hop)
 		{
-			auto id			= it->first;
-			auto & callback	= it->second;
-			if (callback.tick(dt))
+			fwd.header.recipient = nextHops[hop].addr;
+			fwd.header.target = nextHops[hop].id;
+
+			uint32 n = 0;
+			for (uint32 i = 0; i < numKeys; ++i)
 			{
-				// Execute error callback
-				if (callback.onError) callback.onError();
+				if (keyHops[i] != hop) continue;
+
+				entries[n++] = keys[i];
+				if (n == maxKeys)
+				{
+					fwd.header.setPayload<LookupKey>(n);
+					socket.write(&fwd, fwd.header.getSize(), fwd.header.recipient);
 
-				// Remove expired callback
-				callbacks.remove(it);
+					n = 0;
+				}
+			}
 
-				printf("LOG: no reply received for request with id %08x\n", id);
+			if (n > 0)
+			{
+				fwd.header.setPayload<LookupKey>(n);
+				socket.write(&fwd, fwd.header.getSize(), fwd.header.recipient);
 			}
 		}
 
-		printf("LOG: %llu pending requests\n", callbacks.getCount());
+		if (keyHops != stackHops) gMalloc->free(keyHops);
+
+		if (hops)
+		{
+			for (uint32 hop = 0; hop < numNextHops; ++hop)
+				hops[hop] = nextHops[hop];
+			
+			*numHops = numNextHops;
+		}
+
+		return numResolved;
 	}
 
 	void LocalNode::handleRequest(const Request & req)
 	{
+		// Format sender on the stack, logging
+		// must not allocate
+		char sender[INET_ADDRSTRLEN + 1 + 6];
+		getIpString(req.sender, sender, sizeof(sender));
+
+		++load.numRequests;
+		load.numBytes += req.getSize();
+		if (req.type == Request::LOOKUP) ++load.numLookups;
+		else if (req.type == Request::LOOKUP_MANY) load.numLookups += req.numEntries;
+
+		// Source of a request is alive, unless
+		// it is leaving or was not set
+		const NodeInfo & src = req.getSrc<NodeInfo>();
+		if (req.type != Request::LEAVE && (src.addr.host != 0 || src.addr.port != 0)) learnPeer(src);
+
 		switch (req.type)
 		{
 	#if BUILD_DEBUG
 		case Request::PING:
-			printf("LOG: received PING from %s with id 0x%08x\n", *getIpString(req.sender), req.id);
+			printf("LOG: received PING from %s with id 0x%08x\n", sender, req.id);
 			break;
 	#endif
 
 		case Request::REPLY:
-			printf("LOG: received REPLY from %s with id 0x%08x\n", *getIpString(req.sender), req.id);
+			printf("LOG: received REPLY from %s with id 0x%08x\n", sender, req.id);
 			handleReply(req);
 			break;
 
 		case Request::LOOKUP:
-			printf("LOG: received LOOKUP from %s with id 0x%08x and hop count = %u\n", *getIpString(req.sender), req.id, req.hopCount);
+			printf("LOG: received LOOKUP from %s with id 0x%08x and hop count = %u\n", sender, req.id, req.hopCount);
 			handleLookup(req);
 			break;
 
+		case Request::LOOKUP_MANY:
+			printf("LOG: received LOOKUP_MANY from %s with id 0x%08x, %u keys and hop count = %u\n", sender, req.id, req.numEntries, req.hopCount);
+			handleLookupMany(req);
+			break;
+
 		case Request::NOTIFY:
-			printf("LOG: received NOTIFY from %s with id 0x%08x\n", *getIpString(req.sender), req.id);
+			printf("LOG: received NOTIFY from %s with id 0x%08x\n", sender, req.id);
 			handleNotify(req);
 			break;
 
 		case Request::LEAVE:
-			printf("LOG: received LEAVE from %s with id 0x%08x\n", *getIpString(req.sender), req.id);
+			printf("LOG: received LEAVE from %s with id 0x%08x\n", sender, req.id);
 			handleLeave(req);
 			break;
 		
 		case Request::CHECK:
-			printf("LOG: received CHECK from %s with id 0x%08x\n", *getIpString(req.sender), req.id);
+			printf("LOG: received CHECK from %s with id 0x%08x\n", sender, req.id);
 			handleCheck(req);
 			break;
 		
+		case Request::UPDATE:
+			printf("LOG: received UPDATE from %s with id 0x%08x\n", sender, req.id);
+			handleUpdate(req);
+			break;
+		
+		case Request::FINGERS:
+			printf("LOG: received FINGERS from %s with id 0x%08x\n", sender, req.id);
+			handleFingers(req);
+			break;
+
+		case Request::PUT:
+		case Request::GET:
+		case Request::REMOVE:
+			printf("LOG: received data request %u from %s with id 0x%08x and hop count = %u\n", req.type, sender, req.id, req.hopCount);
+			handleData(req);
+			break;
+
+		case Request::SYNC:
+			printf("LOG: received SYNC from %s with id 0x%08x, %u keys\n", sender, req.id, req.numEntries);
+			handleSync(req);
+			break;
+		
 		default:
-			printf("LOG: received UNKOWN from %s with id 0x%08x\n", *getIpString(req.sender), req.id);
+			printf("LOG: received UNKOWN from %s with id 0x%08x\n", sender, req.id);
 			break;
 		}
 	}
 
 	void LocalNode::handleReply(const Request & req)
 	{
-		// Lock all callbacks
-		ScopeLock _(&callbacksGuard);
+		// Reply to a previous run of this node
+		if (req.epoch != epoch) return;
 
-		// Find associated callback
-		auto it = callbacks.find(req.id);
-		if (it != callbacks.nil())
-		{
-			// Execute callback
-			auto callback = it->second;
-			if (callback.onSuccess) callback.onSuccess(req);
+		RequestCallback callback;
+
+		// Batch replies account for each entry
+		const uint32 numUnits = req.flags & Request::BATCH ? req.numEntries : 1U;
 
-			// Remove
-			callbacks.remove(it);
+		// Find associated callback, the request and
+		// its deadline are removed when all replies
+		// are received
+		if (!acquireRequest(req.id, numUnits, callback)) return;
+
+		// Only direct replies measure the
+		// round-trip time of the recipient
+		if (callback.time > 0.0 && req.sender.host == callback.recipient.addr.host && req.sender.port == callback.recipient.addr.port)
+		{
+			const float32 rtt = getTime() - callback.time;
+			rtts.update(req.sender, rtt);
+
+			// Move our coordinate if the
+			// replier advertised its own
+			const NodeInfo & src = req.getSrc<NodeInfo>();
+			if (src.id != id && src.addr.host == req.sender.host && src.addr.port == req.sender.port)
+				self.coord.update(src.coord, rtt);
 		}
+
+		// Execute callback
+		if (callback.onSuccess) callback.onSuccess(req);
 	}
 
 	void LocalNode::handleLookup(const Request & req)
@@ -405,9 +2417,14 @@ namespace Chord
 			res.type = Request::REPLY;
 			res.sender = self.addr;
 			res.recipient = src.addr;
+			res.target = src.id;
 			res.setDst<NodeInfo>(successor);
 			res.reset();
 
+			// Source learns the resolved
+			// range (self, successor]
+			res.setSrc<NodeInfo>(self);
+
 			socket.write<Request>(res, res.recipient);
 		}
 		else
@@ -423,7 +2440,23 @@ namespace Chord
 				res.type = Request::REPLY;
 				res.sender = self.addr;
 				res.recipient = src.addr;
+				res.target = src.id;
 				res.setDst<NodeInfo>(self);
+				res.setSrc<NodeInfo>(self);
+				res.reset();
+
+				socket.write<Request>(res, res.recipient);
+			}
+			else if (req.flags & Request::ITERATIVE)
+			{
+				// Refer source node to next hop
+				Request res{req};
+				res.type = Request::REPLY;
+				res.flags |= Request::REFERRAL;
+				res.sender = self.addr;
+				res.recipient = src.addr;
+				res.target = src.id;
+				res.setDst<NodeInfo>(next);
 				res.reset();
 
 				socket.write<Request>(res, res.recipient);
@@ -434,39 +2467,204 @@ namespace Chord
 				Request fwd{req};
 				fwd.sender	= self.addr;
 				fwd.recipient = next.addr;
+				fwd.target = next.id;
 				
 				socket.write<Request>(fwd, fwd.recipient);
 			}
 		}
 	}
 
+	void LocalNode::handleLookupMany(const Request & req)
+	{
+		const NodeInfo & src = req.getSrc<NodeInfo>();
+		const uint32 numKeys = Math::min(req.numEntries, req.payloadSize / (uint32)sizeof(LookupKey));
+
+		LookupResult resolved[Request::MAX_PAYLOAD_SIZE / sizeof(LookupKey)];
+		const uint32 numResolved = routeLookups(req, req.getPayload<LookupKey>(), numKeys, resolved);
+
+		// Reply to source node with resolved keys
+		const uint32 maxResults = Request::MAX_PAYLOAD_SIZE / sizeof(LookupResult);
+
+		RequestBuffer res;
+		res.header = req;
+		res.header.type = Request::REPLY;
+		res.header.sender = self.addr;
+		res.header.recipient = src.addr;
+		res.header.target = src.id;
+		res.header.reset();
+
+		for (uint32 i = 0; i < numResolved; i += maxResults)
+		{
+			const uint32 n = Math::min(numResolved - i, maxResults);
+			Memory::memcpy(res.payload, resolved + i, n * sizeof(LookupResult));
+			res.header.setPayload<LookupResult>(n);
+
+			socket.write(&res, res.header.getSize(), res.header.recipient);
+		}
+	}
+
 	void LocalNode::handleNotify(const Request & req)
 	{
 		const NodeInfo & src = req.getSrc<NodeInfo>();
 
 		// Reply with current predecessor
-		Request res{req};
-		res.type = Request::REPLY;
-		res.sender = self.addr;
-		res.recipient = src.addr;
-		res.setDst<NodeInfo>(predecessor);
-
-		socket.write<Request>(res, res.recipient);
+		// and our successor list
+		RequestBuffer res;
+		res.header = req;
+		res.header.type = Request::REPLY;
+		res.header.sender = self.addr;
+		res.header.recipient = src.addr;
+		res.header.target = src.id;
+		res.header.setDst<NodeInfo>(predecessor);
+		res.header.setSrc<NodeInfo>(self);
+		res.header.setPayload<NodeInfo>(getSuccessorList(reinterpret_cast<NodeInfo*>(res.payload)));
+
+		// Append our load, past the entries
+		*reinterpret_cast<float32*>(res.payload + res.header.payloadSize) = load.rate;
+		res.header.payloadSize += sizeof(float32);
+
+		socket.write(&res, res.header.getSize(), res.header.recipient);
+
+		bool bNewPredecessor = false;
 		
 		// if predecessor is nil or n -> (predecessor, self)
 		if (predecessor.id == id || rangeOpen(src.id, predecessor.id, id))
 		{
+			bNewPredecessor = true;
+
+			const NodeInfo prev = predecessor;
+
 			// Update predecessor
 			setPredecessor(src);
 
 			printf("LOG: new predecessor is %s\n", *predecessor.getInfoString());
+
+			if (prev.id != id && prev.id != src.id)
+			{
+				// Old predecessor now precedes the
+				// new one, tell it right away rather
+				// than waiting for it to stabilize
+				Request update = makeRequest(Request::UPDATE, prev);
+				update.setSrc<NodeInfo>(self);
+				update.setDst<NodeInfo>(src);
+
+				socket.write<Request>(update, update.recipient);
+			}
+
+			// New predecessor now owns keys in
+			// (prev, src], or in (id, src] if we
+			// were alone. If we had no predecessor,
+			// keys outside our range are routed
+			// from it to their owner. We keep a
+			// copy if we replicate them
+			const bool bKeep = numReplicas > 0;
+
+			uint32 numKeys = 0;
+			if (prev.id != id && prev.id != src.id) numKeys = handOffKeys(src, prev.id, src.id, true, bKeep);
+			else if (prev.id == id && successor.id == id && src.id != id) numKeys = handOffKeys(src, id, src.id, true, bKeep);
+			else if (prev.id == id && src.id != successor.id) numKeys = handOffKeys(src, id, src.id, false, bKeep);
+
+			if (numKeys > 0) printf("LOG: handing off %u keys to %s\n", numKeys, *src.getInfoString());
+		}
+
+		if (numReplicas > 0 && src.id == predecessor.id && src.id != id)
+		{
+			// Predecessor advertises the ranges
+			// we replicate, with its digests
+			const RangeDigest * ranges = req.getPayload<RangeDigest>();
+			const uint32 n = Math::min(Math::min((uint32)req.numEntries, (uint32)(req.payloadSize / sizeof(RangeDigest))), numReplicas);
+
+			{
+				ScopeLock _(&replicasGuard);
+				for (uint32 i = 0; i < n; ++i) replicaRanges[i] = ranges[i];
+				numReplicaRanges = n;
+			}
+
+			// Keys handed off just now are
+			// still in flight
+			if (!bNewPredecessor)
+			{
+				RangeDigest local[MAX_SUCCESSORS];
+				for (uint32 i = 0; i < n; ++i) local[i] = ranges[i];
+
+				store.getDigests(local, n);
+
+				for (uint32 i = 0; i < n; ++i)
+					if (local[i].numKeys != ranges[i].numKeys || local[i].digest != ranges[i].digest)
+					{
+						printf("LOG: replica of range (0x%08x, 0x%08x] differs, %u keys vs %u\n", local[i].start, local[i].end, local[i].numKeys, ranges[i].numKeys);
+						sendSync(src, local[i]);
+					}
+			}
 		}
 	}
 
 	void LocalNode::handleLeave(const Request & req)
 	{
+		const NodeInfo & src = req.getSrc<NodeInfo>();
+		const NodeInfo & prev = req.getDst<NodeInfo>();
+		const NodeInfo * list = req.getPayload<NodeInfo>();
+		const uint32 n = Math::min(req.numEntries, req.payloadSize / (uint32)sizeof(NodeInfo));
+
+		if (src.id == predecessor.id && prev.id != src.id)
+		{
+			// Leaving node's predecessor is now ours,
+			// or nil if it was us
+			setPredecessor(prev.id == id ? self : prev);
+
+			if (prev.id != id) printf("LOG: new predecessor is %s\n", *predecessor.getInfoString());
+		}
+
+		bool newSuccessor = false;
+
+		if (n > 0)
+		{
+			// Leaving node's successor now owns its
+			// keys, replace it in our fingers
+			const NodeInfo & next = list[0].id == src.id ? self : list[0];
+
+			for (uint32 i = 1; i < 32; ++i)
+				if (src.id == fingers[i].id)
+					setFinger(next, i);
+
+			ScopeLock _(&successorsGuard);
+
+			if (src.id == successor.id && next.id == id)
+			{
+				// We are the only node left
+				numSuccessors = 0;
+				setSuccessor(self);
+			}
+			else if (src.id == successor.id)
+			{
+				// Adopt successor list of leaving node
+				uint32 numNodes = 0;
+				for (uint32 i = 1; i < n && numNodes < MAX_SUCCESSORS - 1; ++i)
+				{
+					// List wrapped around the ring
+					if (list[i].id == id || list[i].id == next.id) break;
+
+					successors[numNodes++] = list[i];
+				}
+
+				numSuccessors = numNodes;
+				setSuccessor(next);
+
+				newSuccessor = true;
+			}
+		}
+
+		if (newSuccessor)
+		{
+			printf("LOG: new successor is %s\n", *successor.getInfoString());
+
+			// Notify new successor, which already
+			// knows us from the leaving node
+			stabilize();
+		}
+
 		// Remove leaving node from local view
-		removePeer(req.getSrc<NodeInfo>());
+		removePeer(src);
 	}
 
 	void LocalNode::handleCheck(const Request & req)
@@ -478,9 +2676,274 @@ namespace Chord
 		res.type = Request::REPLY;
 		res.sender = self.addr;
 		res.recipient = src.addr;
+		res.target = src.id;
+
+		// Advertise our coordinate
+		res.setSrc<NodeInfo>(self);
 
 		socket.write<Request>(res, res.recipient);
 
 		// TODO: chain checks along a lookup path
 	}
+
+	void LocalNode::handleUpdate(const Request & req)
+	{
+		const NodeInfo & target = req.getDst<NodeInfo>();
+
+		// Only adopt nodes closer than our
+		// current successor, stale updates
+		// are ignored
+		if (target.id != id && (successor.id == id || rangeOpen(target.id, id, successor.id)))
+		{
+			// Update successor
+			setSuccessor(target);
+
+			printf("LOG: new successor is %s\n", *successor.getInfoString());
+
+			// Notify new successor, its reply
+			// refreshes the successor list
+			stabilize();
+		}
+	}
+
+	void LocalNode::handleFingers(const Request & req)
+	{
+		const NodeInfo & src = req.getSrc<NodeInfo>();
+
+		// Reply with our predecessor and
+		// the distinct nodes in our fingers
+		RequestBuffer res;
+		res.header = req;
+		res.header.type = Request::REPLY;
+		res.header.sender = self.addr;
+		res.header.recipient = src.addr;
+		res.header.target = src.id;
+		res.header.setDst<NodeInfo>(predecessor);
+		res.header.setSrc<NodeInfo>(self);
+
+		NodeInfo * nodes = reinterpret_cast<NodeInfo*>(res.payload);
+		uint32 numNodes = 0;
+
+		// Fingers are sorted along the ring,
+		// duplicates are contiguous
+		for (uint32 i = 0; i < 32; ++i)
+			if (fingers[i].id != id && (numNodes == 0 || nodes[numNodes - 1].id != fingers[i].id))
+				nodes[numNodes++] = fingers[i];
+		
+		// Successor list fills gaps after the successor
+		{
+			ScopeLock _(&successorsGuard);
+
+			for (uint32 i = 0; i < numSuccessors && numNodes < Request::MAX_PAYLOAD_SIZE / sizeof(NodeInfo); ++i)
+				nodes[numNodes++] = successors[i];
+		}
+
+		res.header.setPayload<NodeInfo>(numNodes);
+
+		socket.write(&res, res.header.getSize(), res.header.recipient);
+	}
+
+	void LocalNode::handleData(const Request & req)
+	{
+		const NodeInfo & src = req.getSrc<NodeInfo>();
+		const uint32 key = req.getDst<uint32>();
+		const NodeInfo & next = getDataHop(key);
+
+		// Handed off keys may arrive before we
+		// learn that we own them, others are
+		// routed to their owner
+		const bool bOwner = isOwner(key) || next.id == id;
+		const bool bHandedOff = !bOwner && (req.flags & (Request::HANDOFF | Request::LAST_HOP)) && isHandedOff(key, src);
+
+		if (bOwner || bHandedOff || (req.flags & Request::REPLICA))
+		{
+			// Execute at owner
+			RequestBuffer res;
+			res.header = req;
+			res.header.type = Request::REPLY;
+			res.header.sender = self.addr;
+			res.header.recipient = src.addr;
+			res.header.target = src.id;
+			res.header.setSrc<NodeInfo>(self);
+			res.header.reset();
+
+			// Replica requests are refused if we
+			// don't replicate the key, reads then
+			// fall back to the owner
+			const bool bAllowed = bOwner || bHandedOff || isReplica(key);
+
+			uint32 size = KeyStore::MAX_VALUE_SIZE;
+			const uint32 valueSize = Math::min((uint32)req.payloadSize, (uint32)KeyStore::MAX_VALUE_SIZE);
+			const bool bFound = bAllowed && executeData(req.type, key, req.getPayload<ubyte>(), valueSize, res.payload, &size);
+
+			if (!bFound && req.type == Request::GET && (req.flags & Request::REPLICA) && req.payloadSize >= sizeof(NodeInfo))
+			{
+				// Replica may not have caught up
+				// yet, or we may not replicate the
+				// key, ask the owner it carries
+				const NodeInfo owner = *req.getPayload<NodeInfo>();
+				if (owner.id != id)
+				{
+					Request fwd = req;
+					fwd.sender = self.addr;
+					fwd.recipient = owner.addr;
+					fwd.target = owner.id;
+					fwd.flags = (fwd.flags & ~Request::REPLICA) | Request::LAST_HOP;
+					fwd.setPayload<ubyte>(0);
+
+					socket.write<Request>(fwd, fwd.recipient);
+					return;
+				}
+			}
+
+			// One entry on success, GET
+			// replies carry the value
+			res.header.numEntries = bFound ? 1 : 0;
+			res.header.payloadSize = bFound && req.type == Request::GET ? size : 0;
+
+			const bool bWrite = bFound && req.type != Request::GET;
+			const bool bReplicate = bWrite && !(req.flags & (Request::HANDOFF | Request::REPLICA)) && numReplicas > 0;
+
+			if (bReplicate || (bWrite && store.isPersistent()))
+			{
+				// Reply once replicas ack and the
+				// write is on disk
+				SharedPtr<ReplicatedWrite> write = std::make_shared<ReplicatedWrite>();
+				write->res.header = res.header;
+				write->bRemote = true;
+
+				commitData(req.type, key, req.getPayload<ubyte>(), valueSize, write, bReplicate);
+			}
+			// Handed off keys are acked too
+			else if (req.id != RequestTable::INVALID_ID)
+				socket.write(&res, res.header.getSize(), res.header.recipient);
+		}
+		else
+		{
+			// Forward request with its payload,
+			// as a regular data request
+			RequestBuffer fwd;
+			fwd.header = req;
+			fwd.header.flags &= ~(Request::HANDOFF | Request::LAST_HOP);
+			fwd.header.sender = self.addr;
+			fwd.header.recipient = next.addr;
+			fwd.header.target = next.id;
+
+			if (rangeOpenClosed(key, id, successor.id))
+			{
+				fwd.header.flags |= Request::LAST_HOP;
+
+				if (req.type == Request::GET && numReplicas > 0)
+				{
+					// Serve read from the replica
+					// closest to the source
+					const NodeInfo replica = getNearestReplica(src);
+					if (replica.id != successor.id)
+					{
+						fwd.header.recipient = replica.addr;
+						fwd.header.target = replica.id;
+						fwd.header.flags |= Request::REPLICA;
+
+						// Replica falls back to owner
+						// if it lacks the key
+						*reinterpret_cast<NodeInfo*>(fwd.payload) = successor;
+						fwd.header.setPayload<NodeInfo>(1);
+
+						socket.write(&fwd, fwd.header.getSize(), fwd.header.recipient);
+						return;
+					}
+				}
+			}
+
+			Memory::memcpy(fwd.payload, req.getPayload<ubyte>(), req.payloadSize);
+
+			socket.write(&fwd, fwd.header.getSize(), fwd.header.recipient);
+		}
+	}
+
+	bool LocalNode::isReplica(uint32 key)
+	{
+		ScopeLock _(&replicasGuard);
+
+		for (uint32 i = 0; i < numReplicaRanges; ++i)
+			if (rangeOpenClosed(key, replicaRanges[i].start, replicaRanges[i].end)) return true;
+
+		return false;
+	}
+
+	void LocalNode::handleSync(const Request & req)
+	{
+		const NodeInfo & src = req.getSrc<NodeInfo>();
+		const RangeDigest & range = req.getDst<RangeDigest>();
+		const SyncEntry * entries = req.getPayload<SyncEntry>();
+		const uint32 n = Math::min((uint32)req.numEntries, (uint32)(req.payloadSize / sizeof(SyncEntry)));
+
+		// Push keys the replica lacks or holds
+		// a different value of, ours win
+		RequestBuffer push;
+		push.header = makeRequest(Request::PUT, src);
+		push.header.flags |= Request::REPLICA;
+		push.header.setSrc<NodeInfo>(self);
+
+		uint32 numPushed = 0;
+		store.visit([&range](uint32 key) {
+
+			return rangeOpenClosed(key, range.start, range.end);
+		}, [&](uint32 key, const ubyte * data, uint32 size, uint32 checksum) {
+
+			// Entries are sorted from range start
+			uint32 lo = 0, hi = n;
+			while (lo < hi)
+			{
+				const uint32 mid = (lo + hi) / 2;
+				if (entries[mid].key - range.start < key - range.start) lo = mid + 1;
+				else hi = mid;
+			}
+
+			if (lo < n && entries[lo].key == key && entries[lo].checksum == checksum) return;
+
+			push.header.setDst<uint32>(key);
+			Memory::memcpy(push.payload, data, size);
+			push.header.setPayload<ubyte>(size);
+
+			socket.write(&push, push.header.getSize(), push.header.recipient);
+			++numPushed;
+		});
+
+		// Pull keys we lack, unless we removed
+		// them and the replica missed it
+		uint32 numPulled = 0, numRemoved = 0;
+		for (uint32 i = 0; i < n; ++i)
+		{
+			uint32 checksum;
+			const uint32 key = entries[i].key;
+			if (store.getChecksum(key, checksum)) continue;
+
+			if (store.isRemoved(key))
+			{
+				Request remove = makeRequest(Request::REMOVE, src);
+				remove.flags |= Request::REPLICA;
+				remove.setSrc<NodeInfo>(self);
+				remove.setDst<uint32>(key);
+
+				socket.write<Request>(remove, remove.recipient);
+				++numRemoved;
+				continue;
+			}
+
+			Request pull = makeRequest(Request::GET, src, [this, key](const Request & res) {
+
+				if (res.numEntries > 0 && store.put(key, res.getPayload<ubyte>(), res.payloadSize) && onWrite) onWrite();
+			});
+
+			pull.flags |= Request::REPLICA;
+			pull.setSrc<NodeInfo>(self);
+			pull.setDst<uint32>(key);
+
+			socket.write<Request>(pull, pull.recipient);
+			++numPulled;
+		}
+
+		if (numPushed + numPulled + numRemoved > 0) printf("LOG: synced range (0x%08x, 0x%08x] with %s, pushed %u keys, pulled %u, removed %u\n", range.start, range.end, *src.getInfoString(), numPushed, numPulled, numRemoved);
+	}
 } // namespace Chord
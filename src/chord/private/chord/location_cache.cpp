@@ -0,0 +1,120 @@
+#include "chord/location_cache.h"
+#include "chord/ring_range.h"
+
+namespace Chord
+{
+	LocationCache::LocationCache(uint32 _maxRanges, float32 _maxAge)
+		: ranges{reinterpret_cast<Range*>(gMalloc->malloc(_maxRanges * sizeof(Range)))}
+		, numRanges{0U}
+		, maxRanges{_maxRanges}
+		, maxAge{_maxAge}
+		, guard{}
+	{
+		//
+	}
+
+	LocationCache::~LocationCache()
+	{
+		gMalloc->free(ranges);
+	}
+
+	bool LocationCache::find(uint32 key, Range & range) const
+	{
+		bool bFound = false;
+
+		guard.readLock();
+
+		if (numRanges > 0)
+		{
+			// Range that contains key has the first
+			// owner id not less than key, possibly
+			// wrapping around the ring
+			uint32 i = lowerBound(key);
+			if (i == numRanges) i = 0;
+
+			if (rangeOpenClosed(key, ranges[i].start.id, ranges[i].owner.id))
+			{
+				range = ranges[i];
+				bFound = true;
+			}
+		}
+
+		guard.readUnlock();
+
+		return bFound;
+	}
+
+	void LocationCache::insert(const NodeInfo & start, const NodeInfo & owner)
+	{
+		// Empty range
+		if (start.id == owner.id) return;
+
+		const float64 now = getTime();
+
+		guard.writeLock();
+
+		// Remove ranges whose owner falls in the new range,
+		// they are either the same range or outdated
+		for (uint32 i = 0; i < numRanges;)
+		{
+			if (rangeOpenClosed(ranges[i].owner.id, start.id, owner.id))
+				removeAt(i);
+			else
+				++i;
+		}
+
+		if (numRanges == maxRanges)
+		{
+			// Evict least recently refreshed range
+			uint32 oldest = 0;
+			for (uint32 i = 1; i < numRanges; ++i)
+				if (ranges[i].time < ranges[oldest].time) oldest = i;
+			
+			removeAt(oldest);
+		}
+
+		// Insert sorted
+		const uint32 i = lowerBound(owner.id);
+		Memory::memmove(ranges + i + 1, ranges + i, (numRanges - i) * sizeof(Range));
+		ranges[i] = Range{start, owner, now};
+		++numRanges;
+
+		guard.writeUnlock();
+	}
+
+	void LocationCache::invalidate(const NodeInfo & node)
+	{
+		guard.writeLock();
+
+		for (uint32 i = 0; i < numRanges;)
+		{
+			if (ranges[i].owner.id == node.id || ranges[i].start.id == node.id)
+				removeAt(i);
+			else
+				++i;
+		}
+
+		guard.writeUnlock();
+	}
+
+	uint32 LocationCache::lowerBound(uint32 id) const
+	{
+		uint32 lo = 0, hi = numRanges;
+		while (lo < hi)
+		{
+			const uint32 mid = (lo + hi) / 2;
+			if (ranges[mid].owner.id < id)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		return lo;
+	}
+
+	void LocationCache::removeAt(uint32 i)
+	{
+		Memory::memmove(ranges + i, ranges + i + 1, (numRanges - i - 1) * sizeof(Range));
+		--numRanges;
+	}
+} // namespace Chord
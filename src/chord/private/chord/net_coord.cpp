@@ -0,0 +1,47 @@
+#include "chord/net_coord.h"
+
+namespace Chord
+{
+	void NetCoord::update(const NetCoord & remote, float32 rtt)
+	{
+		// Tuning constants from the Vivaldi paper
+		const float32 ce = 0.25f, cc = 0.25f;
+
+		// Remote node has no coordinate yet
+		if (!remote.isValid() || rtt <= 0.f) return;
+
+		// First sample, start with max error
+		if (!isValid()) error = 1.f;
+
+		const float32 dist = getDistance(remote);
+
+		// Trust samples more if the remote
+		// coordinate is more accurate than ours
+		const float32 w = error / (error + remote.error);
+		const float32 sampleError = PlatformMath::abs(dist - rtt) / rtt;
+
+		error = PlatformMath::min(PlatformMath::max(sampleError * ce * w + error * (1.f - ce * w), 0.01f), 1.f);
+
+		// Unit vector from remote to us, pick
+		// a random one if we overlap
+		float32 dx = pos[0] - remote.pos[0];
+		float32 dy = pos[1] - remote.pos[1];
+		float32 len = PlatformMath::sqrt(dx * dx + dy * dy);
+
+		if (len < 1e-6f)
+		{
+			dx = PlatformMath::randf() - 0.5f;
+			dy = PlatformMath::randf() - 0.5f;
+			len = PlatformMath::sqrt(dx * dx + dy * dy) + 1e-6f;
+		}
+
+		const float32 norm = len + height + remote.height;
+		const float32 force = cc * w * (rtt - dist);
+
+		// Push away if too close, pull
+		// closer if too far
+		pos[0] += force * dx / norm;
+		pos[1] += force * dy / norm;
+		height = PlatformMath::max(height + force * (height + remote.height) / norm, 0.f);
+	}
+} // namespace Chord
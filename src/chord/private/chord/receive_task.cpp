@@ -1,26 +1,114 @@
 #include "chord/receive_task.h"
-#include "chord/local_node.h"
+#include "chord/virtual_host.h"
 
 namespace Chord
 {
-	ReceiveTask::ReceiveTask(LocalNode * _node)
-		: node(_node) {}
+	ReceiveTask::ReceiveTask(VirtualHost * _host)
+		: host{_host}
+		, loop{}
+		, requestsTimer{-1}
+		, bChecking{true}
+	{
+		// Set before the task runs, the timer
+		// starts armed and requests registered
+		// until then are checked anyway
+		if (host)
+			for (uint32 i = 0; i < host->numNodes; ++i)
+				host->nodes[i]->onRequest = [this]() {
+
+					armChecks();
+				};
+	}
 	
 	bool ReceiveTask::init()
 	{
-		return node && node->socket.isInit();
+		if (!host || !host->isInit() || !loop.init()) return false;
+
+		const bool bReading = loop.addReader(host->socket.getFileDescriptor(), [this]() {
+
+			receive();
+		});
+
+		// Run updates
+		const int32 updateTimer = loop.addTimer(1.f, [this]() {
+
+			for (uint32 i = 0; i < host->numNodes; ++i)
+			{
+				host->nodes[i]->stabilize();
+				host->nodes[i]->fixFingers();
+				host->nodes[i]->balanceLoad();
+			}
+		});
+
+		// Run checks
+		const int32 checkTimer = loop.addTimer(2.f, [this]() {
+
+			for (uint32 i = 0; i < host->numNodes; ++i)
+				host->nodes[i]->checkPredecessor();
+		});
+
+		// Expire requests, once per wheel tick
+		requestsTimer = loop.addTimer(host->nodes[0]->timeouts.getResolution(), [this]() {
+
+			for (uint32 i = 0; i < host->numNodes; ++i)
+				host->nodes[i]->checkRequests();
+
+			if (!hasPendingRequests())
+			{
+				// Sleep until next request. Disarm
+				// before clearing the flag, or a
+				// concurrent re-arm may be undone
+				loop.setTimer(requestsTimer, 0.f);
+				bChecking = false;
+
+				if (hasPendingRequests()) armChecks();
+			}
+		});
+
+		return bReading && updateTimer != -1 && checkTimer != -1 && requestsTimer != -1;
 	}
 
 	int32 ReceiveTask::run()
 	{
-		const bool bRunning = true;
-		Request req;
+		return loop.run();
+	}
+
+	void ReceiveTask::stop()
+	{
+		loop.stop();
+	}
+
+	void ReceiveTask::armChecks()
+	{
+		// Only the first request re-arms it
+		if (!bChecking.load(AtomicOrder::Relaxed) && !bChecking.exchange(true))
+			loop.setTimer(requestsTimer, host->nodes[0]->timeouts.getResolution());
+	}
+
+	bool ReceiveTask::hasPendingRequests() const
+	{
+		for (uint32 i = 0; i < host->numNodes; ++i)
+			if (host->nodes[i]->hasPendingRequests()) return true;
+
+		return false;
+	}
+
+	void ReceiveTask::receive()
+	{
+		RequestBuffer buffer;
+		Request & req = buffer.header;
 
-		while (bRunning)
+		// Drain socket
+		int32 len;
+		while ((len = host->socket.tryRead(&buffer, sizeof(buffer), req.sender)) >= 0)
 		{
-			if (node->socket.read(req, req.sender) && !req.hop().isExpired())
+			if (len < (int32)sizeof(Request) || len != (int32)req.getSize())
+				printf("LOG: dropped malformed request from %s\n", *getIpString(req.sender));
+			else if (!req.isCompatible())
+				printf("LOG: dropped request from %s with unknown version %u\n", *getIpString(req.sender), req.version);
+			else if (!req.hop().isExpired())
 				// Single threaded handler
-				node->handleRequest(req);
+				host->handleRequest(req);
 		}
 	}
 } // namespace Chord
@@ -0,0 +1,131 @@
+#include "chord/request_table.h"
+#include "hal/platform_memory.h"
+
+namespace Chord
+{
+	RequestTable::RequestTable(uint32 _capacity, uint32 idBits)
+		: slots{nullptr}
+		, callbacks{nullptr}
+		, capacity{1U}
+		, indexBits{0U}
+		, idMask{idBits < 32 ? (1U << idBits) - 1 : 0xffffffff}
+		, cursor{0U}
+		, count{0U}
+	{
+		// Keep at least 4 bits for generation
+		const uint32 maxIndexBits = idBits - 4;
+
+		while (capacity < _capacity && indexBits < maxIndexBits)
+			capacity <<= 1, ++indexBits;
+
+		// Slots are small and zeroed upfront. Callbacks
+		// are constructed on first use, so that untouched
+		// memory is never committed
+		slots = reinterpret_cast<Slot*>(gMalloc->malloc(capacity * sizeof(Slot)));
+		Memory::memset(slots, 0, capacity * sizeof(Slot));
+
+		callbacks = reinterpret_cast<RequestCallback*>(gMalloc->malloc(capacity * sizeof(RequestCallback), alignof(RequestCallback)));
+	}
+
+	RequestTable::~RequestTable()
+	{
+		for (uint32 i = 0; i < capacity; ++i)
+			if (slots[i].generation) callbacks[i].~RequestCallback();
+
+		gMalloc->free(callbacks);
+		gMalloc->free(slots);
+	}
+
+	uint32 RequestTable::insert(RequestCallback && callback, uint32 numUnits)
+	{
+		if (count.load(AtomicOrder::Relaxed) >= capacity) return INVALID_ID;
+
+		for (uint32 numProbes = 0; numProbes < capacity; ++numProbes)
+		{
+			const uint32 i = cursor++ & (capacity - 1);
+			Slot & slot = slots[i];
+
+			// Claim slot
+			uint32 expected = INVALID_ID;
+			if (!slot.id.compareExchange(expected, BUSY_ID)) continue;
+
+			if (slot.generation == 0)
+				// First use of this slot
+				new (callbacks + i) RequestCallback();
+
+			callbacks[i] = ::move(callback);
+			slot.numUnits = numUnits;
+
+			// Compute new id, skip reserved ids
+			uint32 id;
+			do id = ((++slot.generation << indexBits) | i) & idMask; while (id == INVALID_ID || id == BUSY_ID || slot.generation == 0);
+
+			// Publish request
+			++count;
+			slot.id.store(id);
+
+			return id;
+		}
+
+		// Table is full
+		return INVALID_ID;
+	}
+
+	bool RequestTable::acquire(uint32 id, uint32 numUnits, RequestCallback & callback, bool & bRemoved)
+	{
+		Slot * slot = claim(id);
+		if (!slot) return false;
+
+		bRemoved = slot->numUnits <= numUnits;
+		if (!bRemoved)
+		{
+			slot->numUnits -= numUnits;
+			callback = callbacks[slot - slots];
+
+			// Still pending
+			slot->id.store(id);
+		}
+		else
+			release(slot, callback);
+
+		return true;
+	}
+
+	bool RequestTable::remove(uint32 id, RequestCallback & callback)
+	{
+		Slot * slot = claim(id);
+		if (!slot) return false;
+
+		release(slot, callback);
+		return true;
+	}
+
+	RequestTable::Slot * RequestTable::claim(uint32 id)
+	{
+		if (id == INVALID_ID || id == BUSY_ID) return nullptr;
+
+		Slot & slot = slots[getIndex(id)];
+
+		// Only one thread can own the slot, others
+		// retry until it is published or released
+		for (uint32 numAttempts = 0; numAttempts < MAX_CLAIM_ATTEMPTS; ++numAttempts)
+		{
+			uint32 expected = id;
+			if (slot.id.compareExchange(expected, BUSY_ID)) return &slot;
+			if (expected != BUSY_ID) return nullptr;
+		}
+
+		// Still busy, let caller decide
+		return nullptr;
+	}
+
+	void RequestTable::release(Slot * slot, RequestCallback & callback)
+	{
+		RequestCallback & stored = callbacks[slot - slots];
+		callback = ::move(stored);
+		stored = RequestCallback{};
+
+		--count;
+		slot->id.store(INVALID_ID);
+	}
+} // namespace Chord
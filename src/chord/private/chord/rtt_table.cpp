@@ -0,0 +1,125 @@
+#include "chord/rtt_table.h"
+
+namespace Chord
+{
+	RttTable::RttTable(uint32 _maxPeers, float32 _initialRto, float32 _minRto, float32 _maxRto)
+		: estimates{}
+		, maxPeers{_maxPeers}
+		, initialRto{_initialRto}
+		, minRto{_minRto}
+		, maxRto{_maxRto}
+		, guard{}
+	{
+		//
+	}
+
+	float32 RttTable::getTimeout(const Ipv4 & addr)
+	{
+		float32 rto = initialRto;
+
+		guard.readLock();
+
+		auto it = estimates.find(getKey(addr));
+		if (it != estimates.nil()) rto = it->second.rto;
+
+		guard.readUnlock();
+
+		return rto;
+	}
+
+	float32 RttTable::getRtt(const Ipv4 & addr)
+	{
+		float32 srtt = 0.f;
+
+		guard.readLock();
+
+		auto it = estimates.find(getKey(addr));
+		if (it != estimates.nil()) srtt = it->second.srtt;
+
+		guard.readUnlock();
+
+		return srtt;
+	}
+
+	float32 RttTable::getRttBound(const Ipv4 & addr, float32 k)
+	{
+		float32 bound = 0.f;
+
+		guard.readLock();
+
+		auto it = estimates.find(getKey(addr));
+		if (it != estimates.nil() && it->second.srtt > 0.f) bound = it->second.srtt + k * it->second.rttvar;
+
+		guard.readUnlock();
+
+		return bound;
+	}
+
+	void RttTable::update(const Ipv4 & addr, float32 rtt)
+	{
+		const uint64 key = getKey(addr);
+
+		guard.writeLock();
+
+		auto it = estimates.find(key);
+		if (it == estimates.nil())
+		{
+			if (estimates.getCount() >= maxPeers) evict();
+
+			estimates.insert(key, Estimate{0.f, 0.f, initialRto, 0.0});
+			it = estimates.find(key);
+		}
+
+		Estimate & estimate = it->second;
+
+		if (estimate.srtt <= 0.f)
+		{
+			// First sample, as in RFC 6298
+			estimate.srtt = rtt;
+			estimate.rttvar = rtt * 0.5f;
+		}
+		else
+		{
+			// Deviation is updated first, with
+			// the previous smoothed RTT
+			const float32 err = rtt - estimate.srtt;
+			estimate.rttvar += ((err < 0.f ? -err : err) - estimate.rttvar) * 0.25f;
+			estimate.srtt += err * 0.125f;
+		}
+
+		estimate.rto = PlatformMath::min(PlatformMath::max(estimate.srtt + 4.f * estimate.rttvar, minRto), maxRto);
+		estimate.time = getTime();
+
+		guard.writeUnlock();
+	}
+
+	void RttTable::backoff(const Ipv4 & addr)
+	{
+		const uint64 key = getKey(addr);
+
+		guard.writeLock();
+
+		auto it = estimates.find(key);
+		if (it != estimates.nil())
+			it->second.rto = PlatformMath::min(it->second.rto * 2.f, maxRto);
+		else
+		{
+			if (estimates.getCount() >= maxPeers) evict();
+
+			// Peer never replied, there
+			// is no sample to smooth yet
+			estimates.insert(key, Estimate{0.f, 0.f, PlatformMath::min(initialRto * 2.f, maxRto), getTime()});
+		}
+
+		guard.writeUnlock();
+	}
+
+	void RttTable::evict()
+	{
+		auto oldest = estimates.begin();
+		for (auto it = estimates.begin(); it != estimates.end(); ++it)
+			if (it->second.time < oldest->second.time) oldest = it;
+
+		if (oldest != estimates.end()) estimates.remove(oldest);
+	}
+} // namespace Chord
@@ -0,0 +1,432 @@
+#include "chord/segment_log.h"
+#include "hal/platform_memory.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Chord
+{
+	SegmentLog::SegmentLog()
+		: path{}
+		, segments{}
+		, active{NONE}
+		, nextSeq{0U}
+		, dirFd{-1}
+		, numAppended{0ULL}
+		, numSynced{0ULL}
+		, guard{} {}
+
+	SegmentLog::~SegmentLog()
+	{
+		flush();
+
+		for (uint32 i = 0; i < MAX_SEGMENTS; ++i)
+		{
+			Segment * seg = segments[i];
+			if (!seg) continue;
+
+			::munmap(seg->data, SEGMENT_SIZE);
+			::close(seg->fd);
+
+			if (seg->entries) gMalloc->free(seg->entries);
+			delete seg;
+		}
+
+		if (dirFd != -1) ::close(dirFd);
+	}
+
+	bool SegmentLog::open(const char * _path)
+	{
+		snprintf(path, sizeof(path), "%s", _path);
+
+		if (::mkdir(path, 0755) < 0 && errno != EEXIST)
+		{
+			fprintf(stderr, "%s\n", strerror(errno));
+			return false;
+		}
+
+		DIR * dir = ::opendir(path);
+		if (!dir) return false;
+
+		// Map all segment files
+		while (const dirent * file = ::readdir(dir))
+		{
+			uint32 seq; char ext[8] = {};
+			if (strlen(file->d_name) != 12 || sscanf(file->d_name, "%08x.%3s", &seq, ext) != 2 || strcmp(ext, "log") != 0) continue;
+
+			const uint32 segment = mapSegment(seq);
+			if (segment == NONE) continue;
+
+			Segment * seg = segments[segment];
+			const Trailer & trailer = getTrailer(seg->data);
+
+			if (checkFooter(segment))
+			{
+				// Sealed, index is in the footer
+				seg->writeOffset = seg->syncOffset = trailer.footerOffset;
+				seg->numEntries = trailer.numEntries;
+				seg->bSealed = seg->bSynced = true;
+			}
+			else
+			{
+				// Open or damaged, records
+				// are checked one by one
+				if (trailer.magic != 0) fprintf(stderr, "damaged footer in segment %08x, scanning records\n", seq);
+				scan(segment);
+			}
+
+			nextSeq = Math::max(nextSeq, seq + 1);
+		}
+
+		::closedir(dir);
+
+		dirFd = ::open(path, O_RDONLY | O_DIRECTORY);
+
+		// Continue the newest segment, seal
+		// the others if a crash left them open
+		uint32 newest = NONE;
+		for (uint32 i = 0; i < MAX_SEGMENTS; ++i)
+			if (segments[i] && (newest == NONE || segments[i]->seq > segments[newest]->seq)) newest = i;
+
+		for (uint32 i = 0; i < MAX_SEGMENTS; ++i)
+			if (segments[i] && !segments[i]->bSealed && i != newest) seal(i);
+
+		if (newest != NONE && !segments[newest]->bSealed)
+			active = newest;
+		else
+			return rotate();
+
+		return true;
+	}
+
+	ubyte * SegmentLog::append(uint32 key, const void * data, uint32 size, uint32 checksum, uint32 & segment)
+	{
+		ScopeLock _(&guard);
+
+		if (active == NONE) return nullptr;
+
+		const uint32 recordSize = getRecordSize(size);
+		Segment * seg = segments[active];
+
+		// Leave room for footer
+		if (seg->writeOffset + recordSize + (seg->numEntries + 1) * sizeof(FooterEntry) + sizeof(Trailer) > SEGMENT_SIZE)
+		{
+			seal(active);
+			if (!rotate()) return nullptr;
+
+			seg = segments[active];
+		}
+
+		const uint32 offset = seg->writeOffset;
+		RecordHeader & header = *reinterpret_cast<RecordHeader*>(seg->data + offset);
+		ubyte * value = reinterpret_cast<ubyte*>(&header + 1);
+
+		if (size != TOMBSTONE && size > 0) Memory::memcpy(value, data, size);
+		header.key = key;
+		header.size = size;
+		header._pad = 0;
+		header.checksum = getChecksum(header);
+
+		addEntry(seg, key, offset, size, size == TOMBSTONE ? 0 : checksum);
+		seg->writeOffset += recordSize;
+		++numAppended;
+
+		segment = active;
+		return value;
+	}
+
+	void SegmentLog::release(uint32 segment, uint32 size)
+	{
+		ScopeLock _(&guard);
+
+		if (segment < MAX_SEGMENTS && segments[segment])
+			segments[segment]->numDeadBytes += getRecordSize(size);
+	}
+
+	uint32 SegmentLog::flush()
+	{
+		/// A range to sync
+		struct Range
+		{
+			Segment * seg;
+			uint32 start;
+			uint32 end;
+			bool bSealed;
+		};
+
+		Range ranges[MAX_SEGMENTS];
+		uint32 numRanges = 0;
+
+		// Records appended before the ranges
+		// are collected are all in them
+		uint64 numRecords;
+
+		{
+			ScopeLock _(&guard);
+
+			numRecords = numAppended.load();
+
+			// Collect all the records written
+			// since last flush, then sync them
+			// without blocking writers
+			for (uint32 i = 0; i < MAX_SEGMENTS; ++i)
+			{
+				Segment * seg = segments[i];
+				if (!seg || seg->bSynced) continue;
+
+				if (seg->bSealed)
+					ranges[numRanges++] = Range{seg, seg->syncOffset, SEGMENT_SIZE, true};
+				else if (seg->writeOffset > seg->syncOffset)
+					ranges[numRanges++] = Range{seg, seg->syncOffset, seg->writeOffset, false};
+			}
+		}
+
+		static const uint32 pageSize = (uint32)::sysconf(_SC_PAGESIZE);
+		uint32 numBytes = 0;
+		bool bSynced = true;
+
+		for (uint32 i = 0; i < numRanges; ++i)
+		{
+			Range & range = ranges[i];
+			const uint32 start = range.start & ~(pageSize - 1);
+
+			if (::msync(range.seg->data + start, range.end - start, MS_SYNC) < 0)
+			{
+				// Range is synced again on
+				// next flush
+				fprintf(stderr, "could not sync segment %08x: %s\n", range.seg->seq, strerror(errno));
+
+				range.seg = nullptr;
+				bSynced = false;
+				continue;
+			}
+
+			numBytes += range.end - range.start;
+		}
+
+		{
+			ScopeLock _(&guard);
+
+			for (uint32 i = 0; i < numRanges; ++i)
+			{
+				Range & range = ranges[i];
+				if (!range.seg) continue;
+
+				range.seg->syncOffset = Math::max(range.seg->syncOffset, range.end);
+				if (range.bSealed) range.seg->bSynced = true;
+			}
+
+			// Writers wait for all their
+			// records to be synced
+			if (bSynced && numRecords > numSynced.load()) numSynced.store(numRecords);
+		}
+
+		return numBytes;
+	}
+
+	uint32 SegmentLog::getCompactionCandidate()
+	{
+		ScopeLock _(&guard);
+
+		uint32 candidate = NONE;
+		float32 maxRatio = 0.5f;
+
+		for (uint32 i = 0; i < MAX_SEGMENTS; ++i)
+		{
+			const Segment * seg = segments[i];
+			if (!seg || !seg->bSynced || i == active) continue;
+
+			// Segments with no records are
+			// always worth dropping
+			const float32 ratio = seg->writeOffset > 0 ? (float32)seg->numDeadBytes / seg->writeOffset : 1.f;
+			if (ratio >= maxRatio)
+			{
+				candidate = i;
+				maxRatio = ratio;
+			}
+		}
+
+		return candidate;
+	}
+
+	bool SegmentLog::isOldest(uint32 segment)
+	{
+		ScopeLock _(&guard);
+
+		for (uint32 i = 0; i < MAX_SEGMENTS; ++i)
+			if (segments[i] && segments[i]->seq < segments[segment]->seq) return false;
+
+		return true;
+	}
+
+	void SegmentLog::drop(uint32 segment)
+	{
+		ScopeLock _(&guard);
+
+		Segment * seg = segments[segment];
+		if (!seg) return;
+
+		char name[sizeof(path) + 16];
+		snprintf(name, sizeof(name), "%s/%08x.log", path, seg->seq);
+
+		::munmap(seg->data, SEGMENT_SIZE);
+		::close(seg->fd);
+		::unlink(name);
+
+		if (seg->entries) gMalloc->free(seg->entries);
+		delete seg;
+
+		segments[segment] = nullptr;
+	}
+
+	uint32 SegmentLog::getChecksum(const void * data, uint32 size, uint32 hash)
+	{
+		// FNV-1a
+		const ubyte * bytes = reinterpret_cast<const ubyte*>(data);
+		for (uint32 i = 0; i < size; ++i)
+			hash = (hash ^ bytes[i]) * 16777619U;
+
+		return hash;
+	}
+
+	uint32 SegmentLog::getChecksum(const RecordHeader & header)
+	{
+		uint32 hash = getChecksum(&header.key, sizeof(uint32) * 2);
+		if (header.size != TOMBSTONE) hash = getChecksum(&header + 1, header.size, hash);
+
+		return hash;
+	}
+
+	uint32 SegmentLog::getChecksum(const Trailer & trailer, const FooterEntry * entries)
+	{
+		const uint32 hash = getChecksum(entries, trailer.numEntries * sizeof(FooterEntry));
+		return getChecksum(&trailer, sizeof(Trailer) - sizeof(uint32), hash);
+	}
+
+	bool SegmentLog::checkFooter(uint32 segment)
+	{
+		const Segment * seg = segments[segment];
+		const Trailer & trailer = getTrailer(seg->data);
+
+		if (trailer.magic != MAGIC || (uint64)trailer.footerOffset + (uint64)trailer.numEntries * sizeof(FooterEntry) > SEGMENT_SIZE - sizeof(Trailer)) return false;
+
+		const FooterEntry * entries = reinterpret_cast<const FooterEntry*>(seg->data + trailer.footerOffset);
+		if (trailer.checksum != getChecksum(trailer, entries)) return false;
+
+		// Records are in log order and
+		// must end before the footer
+		uint64 end = 0;
+		for (uint32 i = 0; i < trailer.numEntries; ++i)
+		{
+			const FooterEntry & entry = entries[i];
+			if (entry.offset < end || (entry.size != TOMBSTONE && entry.size > SEGMENT_SIZE)) return false;
+
+			end = (uint64)entry.offset + getRecordSize(entry.size);
+			if (end > trailer.footerOffset) return false;
+		}
+
+		return true;
+	}
+
+	uint32 SegmentLog::mapSegment(uint32 seq)
+	{
+		uint32 segment = 0;
+		while (segment < MAX_SEGMENTS && segments[segment]) ++segment;
+		if (segment == MAX_SEGMENTS) return NONE;
+
+		char name[sizeof(path) + 16];
+		snprintf(name, sizeof(name), "%s/%08x.log", path, seq);
+
+		const int32 fd = ::open(name, O_RDWR | O_CREAT, 0644);
+		if (fd < 0) return NONE;
+
+		// New files are zero filled
+		struct stat info;
+		if (::fstat(fd, &info) < 0 || (info.st_size < SEGMENT_SIZE && ::ftruncate(fd, SEGMENT_SIZE) < 0))
+		{
+			::close(fd);
+			return NONE;
+		}
+
+		void * data = ::mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			::close(fd);
+			return NONE;
+		}
+
+		segments[segment] = new Segment{seq, fd, reinterpret_cast<ubyte*>(data), 0U, 0U, 0U, nullptr, 0U, 0U, false, false};
+		return segment;
+	}
+
+	void SegmentLog::scan(uint32 segment)
+	{
+		Segment * seg = segments[segment];
+		const uint32 end = SEGMENT_SIZE - sizeof(Trailer);
+
+		uint32 offset = 0;
+		while (offset + sizeof(RecordHeader) <= end)
+		{
+			const RecordHeader & header = *reinterpret_cast<const RecordHeader*>(seg->data + offset);
+			if (header.size != TOMBSTONE && header.size > end) break;
+
+			const uint32 recordSize = getRecordSize(header.size);
+			if (offset + recordSize > end || header.checksum != getChecksum(header)) break;
+
+			addEntry(seg, header.key, offset, header.size, header.size == TOMBSTONE ? 0 : getChecksum(&header + 1, header.size));
+			offset += recordSize;
+		}
+
+		seg->writeOffset = seg->syncOffset = offset;
+	}
+
+	void SegmentLog::addEntry(Segment * seg, uint32 key, uint32 offset, uint32 size, uint32 checksum)
+	{
+		if (seg->numEntries == seg->maxEntries)
+		{
+			seg->maxEntries = Math::max(seg->maxEntries * 2, 256U);
+			seg->entries = reinterpret_cast<FooterEntry*>(seg->entries
+				? gMalloc->realloc(seg->entries, seg->maxEntries * sizeof(FooterEntry))
+				: gMalloc->malloc(seg->maxEntries * sizeof(FooterEntry)));
+		}
+
+		seg->entries[seg->numEntries++] = FooterEntry{key, offset, size, checksum};
+	}
+
+	void SegmentLog::seal(uint32 segment)
+	{
+		Segment * seg = segments[segment];
+
+		// Footer follows the records
+		Trailer & trailer = getTrailer(seg->data);
+		trailer.footerOffset = seg->writeOffset;
+		trailer.numEntries = seg->numEntries;
+		trailer.magic = MAGIC;
+
+		if (seg->numEntries > 0) Memory::memcpy(seg->data + trailer.footerOffset, seg->entries, seg->numEntries * sizeof(FooterEntry));
+		trailer.checksum = getChecksum(trailer, reinterpret_cast<const FooterEntry*>(seg->data + trailer.footerOffset));
+
+		gMalloc->free(seg->entries);
+		seg->entries = nullptr;
+		seg->maxEntries = 0;
+		seg->bSealed = true;
+
+		if (segment == active) active = NONE;
+	}
+
+	bool SegmentLog::rotate()
+	{
+		const uint32 segment = mapSegment(nextSeq++);
+		if (segment == NONE) return false;
+
+		// Make new file durable
+		if (dirFd != -1) ::fsync(dirFd);
+
+		active = segment;
+		return true;
+	}
+} // namespace Chord
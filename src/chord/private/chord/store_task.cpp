@@ -0,0 +1,83 @@
+#include "chord/store_task.h"
+#include "chord/virtual_host.h"
+
+namespace Chord
+{
+	StoreTask::StoreTask(VirtualHost * _host)
+		: host{_host}
+		, loop{}
+		, flushTimer{-1}
+		, bFlushing{true}
+	{
+		// Set before the task runs, the timer
+		// starts armed and writes done until
+		// then are synced anyway
+		if (host)
+			for (uint32 i = 0; i < host->numNodes; ++i)
+				host->nodes[i]->onWrite = [this]() {
+
+					armFlushes();
+				};
+	}
+	
+	bool StoreTask::init()
+	{
+		if (!host || !host->isInit() || !loop.init()) return false;
+
+		// Group commit, one sync for all
+		// the writes of the last period
+		flushTimer = loop.addTimer(FLUSH_PERIOD, [this]() {
+
+			for (uint32 i = 0; i < host->numNodes; ++i)
+				host->nodes[i]->flushStore();
+
+			if (!hasPendingWrites())
+			{
+				// Sleep until next write. Disarm
+				// before clearing the flag, or a
+				// concurrent re-arm may be undone
+				loop.setTimer(flushTimer, 0.f);
+				bFlushing = false;
+
+				if (hasPendingWrites()) armFlushes();
+			}
+		});
+
+		// Reclaim dead records
+		const int32 compactTimer = loop.addTimer(5.f, [this]() {
+
+			for (uint32 i = 0; i < host->numNodes; ++i)
+				host->nodes[i]->compactStore();
+
+			// Sync moved records
+			if (hasPendingWrites()) armFlushes();
+		});
+
+		return flushTimer != -1 && compactTimer != -1;
+	}
+
+	int32 StoreTask::run()
+	{
+		return loop.run();
+	}
+
+	void StoreTask::stop()
+	{
+		loop.stop();
+	}
+
+	void StoreTask::armFlushes()
+	{
+		// Only the first write re-arms it
+		if (!bFlushing.load(AtomicOrder::Relaxed) && !bFlushing.exchange(true))
+			loop.setTimer(flushTimer, FLUSH_PERIOD);
+	}
+
+	bool StoreTask::hasPendingWrites() const
+	{
+		for (uint32 i = 0; i < host->numNodes; ++i)
+			if (host->nodes[i]->hasPendingWrites()) return true;
+
+		return false;
+	}
+} // namespace Chord
@@ -0,0 +1,229 @@
+#include "chord/timer_wheel.h"
+#include "misc/time.h"
+
+namespace Chord
+{
+	TimerWheel::TimerWheel(float32 _resolution, uint32 maxTimers, uint32 inboxSize)
+		: resolution{_resolution}
+		, startTime{getTime()}
+		, currTick{0ULL}
+		, entries{reinterpret_cast<Entry*>(gMalloc->malloc(maxTimers * sizeof(Entry)))}
+		, numEntries{0U}
+		, maxEntries{maxTimers}
+		, count{0ULL}
+		, inbox{nullptr}
+		, inboxMask{0ULL}
+		, inboxHead{0ULL}
+		, inboxTail{0ULL}
+	{
+		for (uint32 i = 0; i <= EXPIRED; ++i)
+			buckets[i] = NIL;
+
+		// Inbox size must be a power of 2
+		uint64 size = 1ULL;
+		while (size < inboxSize) size <<= 1;
+		inboxMask = size - 1;
+
+		inbox = reinterpret_cast<Arrival*>(gMalloc->malloc(size * sizeof(Arrival)));
+		for (uint64 i = 0; i < size; ++i)
+			inbox[i].sequence.store(i);
+	}
+
+	TimerWheel::~TimerWheel()
+	{
+		if (entries) gMalloc->free(entries);
+		if (inbox) gMalloc->free(inbox);
+	}
+
+	void TimerWheel::arm(uint32 timer, uint64 key, float32 timeout)
+	{
+		push(timer, key, getTick(getTime() + timeout) + 1);
+	}
+
+	void TimerWheel::cancel(uint32 timer, uint64 key)
+	{
+		push(timer, key, CANCEL);
+	}
+
+	void TimerWheel::advance()
+	{
+		const uint64 targetTick = getTick(getTime());
+
+		ScopeLock _(&guard);
+		drain();
+
+		while (currTick < targetTick)
+		{
+			++currTick;
+
+			// Cascade upper levels when lower level wraps
+			for (uint32 level = 1; level < NUM_LEVELS; ++level)
+			{
+				if ((currTick & ((1ULL << (LEVEL_BITS * level)) - 1)) != 0) break;
+
+				const uint32 bucket = level * NUM_SLOTS + ((currTick >> (LEVEL_BITS * level)) & SLOT_MASK);
+				uint32 it = buckets[bucket]; buckets[bucket] = NIL;
+
+				while (it != NIL)
+				{
+					const uint32 next = entries[it].next;
+					schedule(it);
+					it = next;
+				}
+			}
+
+			// Expire current slot
+			const uint32 bucket = currTick & SLOT_MASK;
+			uint32 it = buckets[bucket]; buckets[bucket] = NIL;
+
+			while (it != NIL)
+			{
+				const uint32 next = entries[it].next;
+				link(it, EXPIRED);
+				it = next;
+			}
+		}
+	}
+
+	bool TimerWheel::popExpired(uint64 & key)
+	{
+		ScopeLock _(&guard);
+
+		const uint32 i = buckets[EXPIRED];
+		if (i == NIL) return false;
+
+		key = entries[i].key;
+
+		unlink(i);
+		entries[i].bucket = FREE;
+
+		--count;
+		return true;
+	}
+
+	void TimerWheel::push(uint32 timer, uint64 key, uint64 deadline)
+	{
+		// Bounded MPSC queue, producers
+		// race to reserve a cell
+		uint64 pos = inboxTail.load(AtomicOrder::Relaxed);
+		for (;;)
+		{
+			Arrival & cell = inbox[pos & inboxMask];
+			const int64 diff = (int64)cell.sequence.load() - (int64)pos;
+
+			if (diff == 0)
+			{
+				if (inboxTail.compareExchange(pos, pos + 1))
+				{
+					cell.timer = timer;
+					cell.deadline = deadline;
+					cell.key = key;
+
+					// Publish to consumer
+					cell.sequence.store(pos + 1);
+					return;
+				}
+			}
+			else if (diff < 0)
+				// Inbox is full
+				break;
+			else
+				pos = inboxTail.load(AtomicOrder::Relaxed);
+		}
+
+		// Slow path, apply pending operations
+		// first to preserve their order
+		ScopeLock _(&guard);
+		drain();
+		apply(timer, key, deadline);
+	}
+
+	void TimerWheel::apply(uint32 timer, uint64 key, uint64 deadline)
+	{
+		if (timer >= numEntries)
+		{
+			// Nothing to cancel
+			if (deadline == CANCEL || timer >= maxEntries) return;
+
+			// First use of entry
+			for (; numEntries <= timer; ++numEntries)
+				entries[numEntries].bucket = FREE;
+		}
+
+		Entry & entry = entries[timer];
+		if (deadline == CANCEL)
+		{
+			// Timer was re-armed for another key
+			if (entry.bucket == FREE || entry.key != key) return;
+
+			unlink(timer);
+			entry.bucket = FREE;
+			--count;
+			return;
+		}
+
+		if (entry.bucket != FREE)
+			// Replace armed timer
+			unlink(timer);
+		else
+			++count;
+
+		entry.key = key;
+		entry.deadline = deadline > currTick ? deadline : currTick + 1;
+
+		schedule(timer);
+	}
+
+	void TimerWheel::drain()
+	{
+		for (;;)
+		{
+			Arrival & cell = inbox[inboxHead & inboxMask];
+			if (cell.sequence.load() != inboxHead + 1) break;
+
+			apply(cell.timer, cell.key, cell.deadline);
+
+			// Release cell
+			cell.sequence.store(inboxHead + inboxMask + 1);
+			++inboxHead;
+		}
+	}
+
+	void TimerWheel::schedule(uint32 i)
+	{
+		const uint64 deadline = entries[i].deadline > currTick ? entries[i].deadline : currTick;
+		const uint64 delta = deadline - currTick;
+
+		// Find smallest level that spans deadline
+		uint32 level = 0;
+		while (level < NUM_LEVELS - 1 && delta >> (LEVEL_BITS * (level + 1))) ++level;
+
+		// Far timers wait in the last level
+		// and are rescheduled when cascaded
+		const uint64 span = 1ULL << (LEVEL_BITS * NUM_LEVELS);
+		const uint64 tick = delta < span ? deadline : currTick + span - 1;
+
+		link(i, level * NUM_SLOTS + ((tick >> (LEVEL_BITS * level)) & SLOT_MASK));
+	}
+
+	void TimerWheel::link(uint32 i, uint32 bucket)
+	{
+		Entry & entry = entries[i];
+		entry.bucket = bucket;
+		entry.prev = NIL;
+		entry.next = buckets[bucket];
+
+		if (entry.next != NIL) entries[entry.next].prev = i;
+		buckets[bucket] = i;
+	}
+
+	void TimerWheel::unlink(uint32 i)
+	{
+		Entry & entry = entries[i];
+
+		if (entry.prev != NIL) entries[entry.prev].next = entry.next;
+		else buckets[entry.bucket] = entry.next;
+
+		if (entry.next != NIL) entries[entry.next].prev = entry.prev;
+	}
+} // namespace Chord
@@ -0,0 +1,119 @@
+#include "chord/virtual_host.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+namespace Chord
+{
+	VirtualHost::VirtualHost(uint32 _numNodes, uint16 port, uint32 maxRequests)
+		: socket{}
+		, nodes{}
+		, numNodes{0U}
+	{
+		Ipv4 addr = Ipv4::any;
+		addr.setPort(port);
+
+		// Initialize socket
+		if (socket.init() && socket.bind(addr))
+		{
+			_numNodes = Math::min(Math::max(_numNodes, 1U), (uint32)MAX_NODES);
+
+			for (; numNodes < _numNodes; ++numNodes)
+				nodes[numNodes] = new LocalNode(socket, numNodes, maxRequests);
+		}
+	}
+
+	VirtualHost::~VirtualHost()
+	{
+		for (uint32 i = 0; i < numNodes; ++i)
+			delete nodes[i];
+	}
+
+	bool VirtualHost::openStores(const char * path)
+	{
+		if (::mkdir(path, 0755) < 0 && errno != EEXIST) return false;
+
+		for (uint32 i = 0; i < numNodes; ++i)
+		{
+			// Stores follow node index, which
+			// together with port gives the id
+			char nodePath[256];
+			snprintf(nodePath, sizeof(nodePath), "%s/node%u", path, i);
+
+			if (!nodes[i]->openStore(nodePath)) return false;
+		}
+
+		return true;
+	}
+
+	void VirtualHost::create()
+	{
+		// Other nodes route their join
+		// through the first one
+		const Ipv4 & addr = nodes[0]->getPublicAddress();
+
+		for (uint32 i = 1; i < numNodes; ++i)
+			if (!nodes[i]->join(addr)) printf("LOG: virtual node %s could not join\n", *nodes[i]->self.getInfoString());
+	}
+
+	bool VirtualHost::join(const Ipv4 & peer)
+	{
+		if (!nodes[0]->join(peer)) return false;
+
+		create();
+		return true;
+	}
+
+	void VirtualHost::leave()
+	{
+		// Nodes must not hand off their neighbours
+		// and keys to nodes that are leaving too
+		for (uint32 i = 0; i < numNodes; ++i)
+			for (uint32 j = 0; j < numNodes; ++j)
+				if (i != j) nodes[i]->removePeer(nodes[j]->self);
+
+		// Nodes hand off keys concurrently,
+		// the receive task processes acks
+		Promise<uint32> handoffs[MAX_NODES];
+		for (uint32 i = 0; i < numNodes; ++i)
+			handoffs[i] = nodes[i]->leave();
+
+		for (uint32 i = 0; i < numNodes; ++i)
+		{
+			const uint32 numKeys = handoffs[i].get();
+			if (numKeys > 0) printf("LOG: handed off %u keys of node %s\n", numKeys, *nodes[i]->self.getInfoString());
+		}
+	}
+
+	LocalNode * VirtualHost::findNode(uint32 id) const
+	{
+		for (uint32 i = 0; i < numNodes; ++i)
+			if (nodes[i]->id == id) return nodes[i];
+		
+		return nullptr;
+	}
+
+	LocalNode * VirtualHost::findMovedNode(uint32 id) const
+	{
+		for (uint32 i = 0; i < numNodes; ++i)
+			if (nodes[i]->prevId == id) return nodes[i];
+		
+		return nullptr;
+	}
+
+	void VirtualHost::handleRequest(const Request & req)
+	{
+		LocalNode * node = findNode(req.target);
+
+		// Replies to requests sent before a node
+		// moved are addressed to its old id. The
+		// request table drops those not pending
+		if (!node && req.type == Request::REPLY)
+			node = findMovedNode(req.target);
+
+		if (node)
+			node->handleRequest(req);
+		else if (req.type != Request::REPLY)
+			nodes[0]->handleRequest(req);
+	}
+} // namespace Chord
@@ -1,8 +1,13 @@
 #include "misc/time.h"
 
+#include <time.h>
+
 //////////////////////////////////////////////////
-// Time global variables
+// Time global functions
 //////////////////////////////////////////////////
 
-uint64 currTick = 0;
-uint64 prevTick = 0;
\ No newline at end of file
+float64 getTime()
+{
+	timespec now; clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1.e-9;
+}
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include "net/event_loop.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace Net
+{
+	EventLoop::EventLoop()
+		: epollfd{-1}
+		, wakefd{-1}
+		, sources{}
+		, bStopped{false} {}
+
+	EventLoop::~EventLoop()
+	{
+		for (Source * source : sources)
+		{
+			// Timers are owned by the loop
+			if (source->bTimer) ::close(source->fd);
+			delete source;
+		}
+
+		if (wakefd != -1) ::close(wakefd);
+		if (epollfd != -1) ::close(epollfd);
+	}
+
+	bool EventLoop::init()
+	{
+		if (epollfd == -1) epollfd = ::epoll_create1(EPOLL_CLOEXEC);
+		if (wakefd == -1) wakefd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+		if (!isInit())
+		{
+			fprintf(stderr, "%s\n", strerror(errno));
+			return false;
+		}
+
+		// Wakeup event has no source
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr;
+
+		return ::epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd, &ev) == 0 || errno == EEXIST;
+	}
+
+	bool EventLoop::addReader(int32 fd, HandlerT && handler)
+	{
+		Source * source = new Source{fd, false, ::move(handler)};
+
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.ptr = source;
+
+		if (::epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		{
+			fprintf(stderr, "%s\n", strerror(errno));
+
+			delete source;
+			return false;
+		}
+
+		sources.push(source);
+		return true;
+	}
+
+	int32 EventLoop::addTimer(float32 interval, HandlerT && handler)
+	{
+		const int32 timerfd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (timerfd < 0)
+		{
+			fprintf(stderr, "%s\n", strerror(errno));
+			return -1;
+		}
+
+		Source * source = new Source{timerfd, true, ::move(handler)};
+
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.ptr = source;
+
+		if (::epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &ev) < 0 || !setTimer(timerfd, interval))
+		{
+			fprintf(stderr, "%s\n", strerror(errno));
+
+			::close(timerfd);
+			delete source;
+			return -1;
+		}
+
+		sources.push(source);
+		return timerfd;
+	}
+
+	bool EventLoop::setTimer(int32 timer, float32 interval)
+	{
+		const uint64 nsecs = (uint64)(interval * 1.e9);
+
+		itimerspec spec{};
+		spec.it_interval.tv_sec = nsecs / 1000000000ULL;
+		spec.it_interval.tv_nsec = nsecs % 1000000000ULL;
+		spec.it_value = spec.it_interval;
+
+		return ::timerfd_settime(timer, 0, &spec, nullptr) == 0;
+	}
+
+	bool EventLoop::runOnce(int32 timeout)
+	{
+		epoll_event events[16];
+
+		const int32 numEvents = ::epoll_wait(epollfd, events, 16, timeout);
+		if (numEvents < 0 && errno != EINTR)
+		{
+			fprintf(stderr, "%s\n", strerror(errno));
+			return false;
+		}
+
+		for (int32 i = 0; i < numEvents; ++i)
+		{
+			Source * source = reinterpret_cast<Source*>(events[i].data.ptr);
+			if (source == nullptr)
+			{
+				// Consume wakeup event
+				uint64 _;
+				while (::read(wakefd, &_, sizeof(_)) > 0);
+				continue;
+			}
+
+			if (source->bTimer)
+			{
+				// Consume expirations, missed
+				// ticks are collapsed into one
+				uint64 _;
+				if (::read(source->fd, &_, sizeof(_)) != sizeof(_)) continue;
+			}
+
+			if (source->handler) source->handler();
+		}
+
+		return !bStopped;
+	}
+
+	int32 EventLoop::run()
+	{
+		if (!isInit()) return 1;
+
+		while (runOnce());
+
+		return 0;
+	}
+
+	void EventLoop::wakeup()
+	{
+		// Counter is only full if a wakeup
+		// is already pending
+		const uint64 one = 1;
+		if (::write(wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			fprintf(stderr, "%s\n", strerror(errno));
+	}
+
+	void EventLoop::stop()
+	{
+		bStopped = true;
+		wakeup();
+	}
+} // namespace Net
@@ -70,16 +70,22 @@ namespace Net
 	}
 
 	template<>
-	String getIpString(const Ipv4 & addr)
+	const char * getIpString(const Ipv4 & addr, char * str, uint32 len)
 	{
-		char str[INET_ADDRSTRLEN + 1 + 6];
+		char ip[INET_ADDRSTRLEN];
 
-		// Ip
-		inet_ntop(AF_INET, &addr.host, str, INET_ADDRSTRLEN);
-		// Port
-		snprintf(str + 17, 6, "%u", htons(addr.port));
+		// Ip and port
+		inet_ntop(AF_INET, &addr.host, ip, INET_ADDRSTRLEN);
+		snprintf(str, len, "%s:%u", ip, ntohs(addr.port));
+
+		return str;
+	}
 
-		return String(str) + ":" + String(str + 17);
+	template<>
+	String getIpString(const Ipv4 & addr)
+	{
+		char str[INET_ADDRSTRLEN + 1 + 6];
+		return String(getIpString(addr, str, sizeof(str)));
 	}
 
 	template<>
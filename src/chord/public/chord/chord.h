@@ -6,7 +6,9 @@
 
 #include "chord_fwd.h"
 #include "types.h"
+#include "ring_range.h"
 #include "request.h"
 #include "local_node.h"
+#include "virtual_host.h"
 #include "receive_task.h"
-#include "update_task.h"
\ No newline at end of file
+#include "store_task.h"
\ No newline at end of file
@@ -14,8 +14,9 @@ namespace Chord
 	using namespace Net;
 
 	class LocalNode;
+	class VirtualHost;
 	class ReceiveTask;
-	class UpdateTask;
+	class StoreTask;
 } // namespace Chord
 
 #include "types.h"
@@ -0,0 +1,439 @@
+#pragma once
+
+#include "coremin.h"
+#include "hal/critical_section.h"
+#include "misc/time.h"
+
+#include "chord_fwd.h"
+#include "ring_range.h"
+#include "request.h"
+#include "segment_log.h"
+
+namespace Chord
+{
+	/**
+	 * @class KeyStore chord/key_store.h
+	 *
+	 * An in-memory key-value store of the keys
+	 * owned by a node. Keys are spread over a
+	 * number of shards, by default one per core,
+	 * each one an open-addressing hash table
+	 * with linear probing and its own lock, so
+	 * that operations on different shards never
+	 * contend
+	 *
+	 * Values are copied in and out, and are at
+	 * most as large as a request payload. If
+	 * the store is opened on a directory, values
+	 * live in a @ref SegmentLog and the index
+	 * points into its mapped segments
+	 *
+	 * Each shard keeps the digests of the key
+	 * ranges that were asked for, and writes
+	 * update them, so that replicas are
+	 * compared without scanning the store
+	 *
+	 * Removed keys leave a tombstone that is
+	 * kept for a while, so that replicas that
+	 * missed a remove don't bring it back
+	 */
+	class KeyStore
+	{
+	public:
+		/// Max size of a value (bytes)
+		enum : uint32 { MAX_VALUE_SIZE = Request::MAX_PAYLOAD_SIZE };
+
+		/// Max number of ranges whose
+		/// digest is kept up to date
+		enum : uint32 { MAX_DIGESTS = 16 };
+
+		/// Time a removed key is remembered
+		/// for (seconds)
+		enum : uint32 { TOMBSTONE_TTL = 600 };
+
+	protected:
+		/// Size of a removed entry
+		enum : uint32 { TOMBSTONE = 0xffffffff };
+
+		/// A table entry, empty if it
+		/// has no value
+		struct Entry
+		{
+			/// Entry key
+			uint32 key;
+
+			/// Size of value (bytes), or
+			/// tombstone if removed
+			uint32 size;
+
+			/// Value buffer
+			ubyte * value;
+
+			/// Log segment of value, or
+			/// none if value is on the heap
+			uint32 segment;
+
+			union
+			{
+				/// Checksum of value
+				uint32 checksum;
+
+				/// Time key was removed
+				/// (seconds), if tombstone
+				uint32 removeTime;
+			};
+		};
+
+		/// Digest of a range kept up to date
+		struct Digest
+		{
+			/// Range and its digest
+			RangeDigest range;
+
+			/// Last time it was asked for
+			uint32 lastUse;
+		};
+
+		/// A store shard
+		struct Shard
+		{
+			/// Entries buffer
+			Entry * entries;
+
+			/// Number of entries, a power of 2
+			uint32 capacity;
+
+			/// Number of keys
+			uint32 count;
+
+			/// Number of keys and tombstones
+			uint32 numUsed;
+
+			/// Digests of keys of shard
+			Digest digests[MAX_DIGESTS];
+
+			/// Number of digests
+			uint32 numDigests;
+
+			/// Number of digest queries
+			uint32 digestTime;
+
+			/// Guards entries
+			RWLock guard;
+		};
+
+		/// Shards buffer
+		Shard * shards;
+
+		/// Number of shards, a power of 2
+		uint32 numShards;
+
+		/// Number of bits of shard index
+		uint32 shardBits;
+
+		/// Log of values, if persistent
+		SegmentLog * log;
+
+	public:
+		/**
+		 * Default constructor
+		 *
+		 * @param [in] numShards number of shards,
+		 * 	0 for one per core
+		 */
+		KeyStore(uint32 numShards = 0U);
+
+		/// Destructor
+		~KeyStore();
+
+		/// Returns number of keys
+		uint32 getCount() const;
+
+		/// Returns true if values are
+		/// written to disk
+		FORCE_INLINE bool isPersistent() const
+		{
+			return log != nullptr;
+		}
+
+		/**
+		 * Write values to a segment log in
+		 * directory and load the values it
+		 * already holds. Must be called
+		 * before the store is used
+		 *
+		 * @param [in] path directory path
+		 * @return true if log was opened
+		 */
+		bool open(const char * path);
+
+		/**
+		 * Sync values written since last
+		 * flush, no-op if not persistent
+		 *
+		 * @return number of bytes synced
+		 */
+		uint32 flush();
+
+		/// Returns a ticket that covers all
+		/// the writes made so far
+		FORCE_INLINE uint64 getWriteTicket() const
+		{
+			return log ? log->getNumAppended() : 0ULL;
+		}
+
+		/// Returns true if all the writes
+		/// covered by ticket are synced
+		FORCE_INLINE bool isSynced(uint64 ticket) const
+		{
+			return !log || log->getNumSynced() >= ticket;
+		}
+
+		/**
+		 * Move live values out of the log
+		 * segment with the most dead records
+		 * and delete it
+		 *
+		 * @param [out] numMoved number of
+		 * 	records moved
+		 * @return true if a segment was
+		 * 	deleted
+		 */
+		bool compact(uint32 & numMoved);
+
+		/**
+		 * Insert or replace value of key
+		 *
+		 * @param [in] key key to write
+		 * @param [in] data value buffer
+		 * @param [in] size size of value (bytes)
+		 * @return true if value was stored
+		 */
+		bool put(uint32 key, const void * data, uint32 size);
+
+		/**
+		 * Copy value of key
+		 *
+		 * @param [in] key key to read
+		 * @param [out] data value buffer
+		 * @param [in,out] size size of buffer,
+		 * 	then size of value (bytes)
+		 * @return true if key was found and
+		 * 	its value matches its checksum
+		 */
+		bool get(uint32 key, void * data, uint32 & size);
+
+		/**
+		 * Remove key
+		 *
+		 * @param [in] key key to remove
+		 * @return true if key was found
+		 */
+		bool remove(uint32 key);
+
+		/**
+		 * Remove key if its value did not
+		 * change since it was read
+		 *
+		 * @param [in] key key to remove
+		 * @param [in] checksum checksum of
+		 * 	value as read
+		 * @return true if key was removed
+		 */
+		bool remove(uint32 key, uint32 checksum);
+
+		/**
+		 * Returns true if key was removed less
+		 * than @ref TOMBSTONE_TTL seconds ago
+		 * and was not written since
+		 *
+		 * @param [in] key key to check
+		 * @return whether key was removed
+		 */
+		bool isRemoved(uint32 key);
+
+		/**
+		 * Get checksum of value of key
+		 *
+		 * @param [in] key key to read
+		 * @param [out] checksum value checksum
+		 * @return true if key was found
+		 */
+		bool getChecksum(uint32 key, uint32 & checksum);
+
+		/**
+		 * Count keys and compute digest of
+		 * ranges. Ranges asked for the first
+		 * time are computed with a scan, then
+		 * kept up to date by writes
+		 *
+		 * @param [in,out] ranges ranges to digest
+		 * @param [in] n number of ranges
+		 */
+		void getDigests(RangeDigest * ranges, uint32 n);
+
+		/**
+		 * Call callback on all keys that
+		 * satisfy a predicate. Shards are
+		 * read locked, callback must not
+		 * write to the store
+		 *
+		 * @param [in] pred bool(uint32 key)
+		 * @param [in] callback void(uint32 key, const ubyte * data, uint32 size, uint32 checksum)
+		 * @return number of keys visited
+		 */
+		template<typename PredT, typename CallbackT>
+		uint32 visit(PredT && pred, CallbackT && callback)
+		{
+			uint32 numKeys = 0;
+
+			for (uint32 i = 0; i < numShards; ++i)
+			{
+				Shard & shard = shards[i];
+				shard.guard.readLock();
+
+				for (uint32 j = 0; j < shard.capacity; ++j)
+				{
+					const Entry & entry = shard.entries[j];
+					if (!entry.value || !pred(entry.key)) continue;
+
+					callback(entry.key, entry.value, entry.size, entry.checksum);
+					++numKeys;
+				}
+
+				shard.guard.readUnlock();
+			}
+
+			return numKeys;
+		}
+
+	protected:
+		/// Returns mixed hash of key, user
+		/// keys are not necessarily uniform.
+		/// Uses the murmur3 finalizer, so
+		/// that low bits affect the shard
+		/// bits and vice versa
+		static FORCE_INLINE uint32 getHash(uint32 key)
+		{
+			uint32 h = key;
+			h ^= h >> 16;
+			h *= 0x85ebca6bU;
+			h ^= h >> 13;
+			h *= 0xc2b2ae35U;
+			h ^= h >> 16;
+			return h;
+		}
+
+		/// Returns term of key in a digest,
+		/// sums of terms don't depend on
+		/// the order of keys
+		static FORCE_INLINE uint32 getDigest(uint32 key, uint32 checksum)
+		{
+			return (key * 0x9e3779b1U) ^ checksum;
+		}
+
+		/**
+		 * Add or remove key from the digests
+		 * of shard ranges that contain it
+		 *
+		 * @param [in] shard shard of key
+		 * @param [in] key key to count
+		 * @param [in] checksum value checksum
+		 * @param [in] bRemove whether key
+		 * 	is removed
+		 */
+		static FORCE_INLINE void updateDigests(Shard & shard, uint32 key, uint32 checksum, bool bRemove)
+		{
+			const uint32 term = getDigest(key, checksum);
+
+			for (uint32 i = 0; i < shard.numDigests; ++i)
+			{
+				RangeDigest & range = shard.digests[i].range;
+				if (!rangeOpenClosed(key, range.start, range.end)) continue;
+
+				if (bRemove) --range.numKeys, range.digest -= term;
+				else ++range.numKeys, range.digest += term;
+			}
+		}
+
+		/**
+		 * Find digest of range in shard, start
+		 * tracking it if not found. Shard must
+		 * be write locked
+		 *
+		 * @param [in] shard shard to search
+		 * @param [in] start,end range of keys
+		 * @return digest of range
+		 */
+		static const RangeDigest & findDigest(Shard & shard, uint32 start, uint32 end);
+
+		/// Returns current time, for tombstones
+		static FORCE_INLINE uint32 getSeconds()
+		{
+			return (uint32)getTime();
+		}
+
+		/// Returns true if entry is a
+		/// tombstone that is not expired
+		static FORCE_INLINE bool isFresh(const Entry & entry, uint32 now)
+		{
+			return !entry.value && entry.size == TOMBSTONE && now - entry.removeTime < TOMBSTONE_TTL;
+		}
+
+		/// Returns shard of key hash
+		FORCE_INLINE Shard & getShard(uint32 hash) const
+		{
+			return shards[shardBits > 0 ? hash >> (32 - shardBits) : 0];
+		}
+
+		/**
+		 * Find entry of key in shard
+		 *
+		 * @param [in] shard shard to search
+		 * @param [in] key key to find
+		 * @param [in] hash hash of key
+		 * @return entry or null
+		 */
+		static Entry * find(Shard & shard, uint32 key, uint32 hash);
+
+		/**
+		 * Insert a new key, key must not
+		 * be in shard. Fresh tombstones of
+		 * other keys are not reused
+		 *
+		 * @param [in] shard shard of key
+		 * @param [in] key key to insert
+		 * @param [in] hash hash of key
+		 * @param [in] value value buffer
+		 * @param [in] size size of value (bytes)
+		 * @param [in] segment log segment of
+		 * 	value or none
+		 * @param [in] checksum value checksum
+		 */
+		void insert(Shard & shard, uint32 key, uint32 hash, ubyte * value, uint32 size, uint32 segment, uint32 checksum);
+
+		/**
+		 * Remove entry from shard, writes
+		 * a tombstone if persistent
+		 *
+		 * @param [in] shard shard of entry
+		 * @param [in] entry entry to remove
+		 * @return false if tombstone could
+		 * 	not be written
+		 */
+		bool erase(Shard & shard, Entry & entry);
+
+		/// Free value of entry, or mark
+		/// its record dead
+		void release(const Entry & entry);
+
+		/**
+		 * Resize shard, drops expired
+		 * tombstones
+		 *
+		 * @param [in] shard shard to resize
+		 * @param [in] capacity new capacity
+		 */
+		static void resize(Shard & shard, uint32 capacity);
+	};
+} // namespace Chord
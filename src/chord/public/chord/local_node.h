@@ -1,14 +1,23 @@
 #pragma once
 
 #include "async/async.h"
+#include "hal/malloc_recycle.h"
 
 #include "chord_fwd.h"
 #include "types.h"
+#include "ring_range.h"
 #include "request.h"
-#include "math/uuid_generator.h"
+#include "timer_wheel.h"
+#include "request_table.h"
+#include "location_cache.h"
+#include "rtt_table.h"
+#include "key_store.h"
 
 namespace Chord
 {
+	/// State of a replicated write
+	struct ReplicatedWrite;
+
 	/**
 	 * @class LocalNode chord/local_node.h
 	 * 
@@ -17,7 +26,132 @@ namespace Chord
 	class LocalNode
 	{
 		friend ReceiveTask;
-		friend UpdateTask;
+		friend StoreTask;
+		friend VirtualHost;
+
+	public:
+		/// Max length of successor list,
+		/// including successor
+		enum : uint32 { MAX_SUCCESSORS = 8 };
+
+		/// Bounds of finger refresh period (seconds)
+		enum : uint32 { MIN_FINGERS_PERIOD = 1, MAX_FINGERS_PERIOD = 32 };
+
+		/// Number of fingers kept below
+		/// the expected successor gap
+		enum : uint32 { FINGERS_MARGIN = 2 };
+
+		/// Max number of candidates per finger
+		enum : uint32 { MAX_CANDIDATES = 4 };
+
+		/// Default max number of pending requests
+		enum : uint32 { DEFAULT_MAX_REQUESTS = 1U << 14 };
+
+		/// Max number of handed off keys waiting
+		/// for an ack, and max number of sends
+		/// of each one
+		enum : uint32 { HANDOFF_WINDOW = 64, MAX_HANDOFF_ATTEMPTS = 3 };
+
+		/// Coordinates with a lower relative error
+		/// are trusted without probing the node
+		static constexpr float32 MAX_COORD_ERROR = 0.5f;
+
+		/// Load sampling period and min time
+		/// between two moves (seconds)
+		enum : uint32 { LOAD_PERIOD = 10, MOVE_COOLDOWN = 300 };
+
+		/// A node moves when its load exceeds
+		/// this many times its successor's
+		static constexpr float32 MAX_LOAD_RATIO = 2.f;
+
+		/// Min load of a node that moves (requests/s)
+		static constexpr float32 MIN_MOVE_LOAD = 10.f;
+
+		/// Load of a node
+		struct Load
+		{
+			/// Requests handled
+			uint64 numRequests;
+
+			/// Lookup keys routed
+			uint64 numLookups;
+
+			/// Bytes received
+			uint64 numBytes;
+
+			/// Keys owned, as of the last sample
+			uint32 numKeys;
+
+			/// Smoothed request rate (requests/s)
+			float32 rate;
+		};
+
+		/// Lookup routing modes
+		enum LookupMode
+		{
+			/// Each hop forwards the lookup,
+			/// the last one replies to source
+			RECURSIVE = 0,
+
+			/// Each hop replies to source with
+			/// the next hop, source drives
+			/// the lookup
+			ITERATIVE
+		};
+
+	protected:
+		/// A lookup in flight
+		struct PendingLookup
+		{
+			/// Max number of hops of an
+			/// iterative lookup that may fail
+			enum : uint32 { MAX_RETRIES = 3 };
+
+			/// Lookup future, no state until
+			/// assigned so that searching the
+			/// map doesn't allocate
+			Promise<NodeInfo> out{nullptr};
+
+			/// First hop, or current hop of
+			/// an iterative lookup
+			NodeInfo next;
+
+			/// Lookup sequence number, tells
+			/// apart lookups of the same key
+			uint32 seq;
+
+			/// Iterative lookups, number of steps
+			/// taken and hops that didn't reply
+			/// @{
+			uint32 numSteps;
+			NodeInfo failed[MAX_RETRIES];
+			uint32 numFailed;
+			/// @}
+
+			/// Hedged lookups, alternative hop, ids
+			/// of first and second request and of
+			/// the hedge timer, and number of
+			/// requests in flight
+			/// @{
+			NodeInfo alt;
+			uint32 reqIds[2];
+			uint32 timerId;
+			uint32 numPending;
+			/// @}
+
+			/// Returns whether node failed
+			/// during this lookup
+			FORCE_INLINE bool hasFailed(const NodeInfo & node) const
+			{
+				for (uint32 i = 0; i < numFailed; ++i)
+					if (failed[i].id == node.id) return true;
+				
+				return false;
+			}
+		};
+
+		/// Lookups map type, nodes are recycled
+		using LookupMap = Map<uint32, PendingLookup, Compare<uint32>, MallocRecycle>;
 
 	protected:
 		union
@@ -40,31 +174,225 @@ namespace Chord
 			NodeInfo successor;
 		};
 
+		/// Nodes that follow our successor,
+		/// nearest first. The first one takes
+		/// over if successor fails
+		NodeInfo successors[MAX_SUCCESSORS - 1];
+
+		/// Number of nodes in successor list
+		uint32 numSuccessors;
+
 		/// Predecessor node
 		NodeInfo predecessor;
 
-		/// Node UDP socket
-		SocketDgram socket;
+		/// Node UDP socket, shared by
+		/// virtual nodes of the same host
+		SocketDgram & socket;
+
+		/// Node epoch, changes every time
+		/// the node is restarted
+		uint32 epoch;
+
+		/// Id before the last move, replies to
+		/// requests sent before it are addressed
+		/// to it. Only used by the receive task
+		uint32 prevId;
+
+		/// Pending requests, lookup gateways
+		/// with a high fan-out need more
+		RequestTable requests;
+
+		/// Pending requests deadlines
+		TimerWheel timeouts;
+
+		/// Round-trip time estimates of
+		/// peers, used to derive timeouts
+		RttTable rtts;
+
+		/// Allocator of lookups map nodes
+		MallocRecycle lookupsMalloc;
+
+		/// Lookups in flight, by key
+		LookupMap lookups;
+
+		/// Sequence number of next lookup
+		uint32 nextLookupSeq;
+
+		/// Recently resolved key ranges
+		LocationCache locations;
 
-		/// Request id generator
-		UUIdGenerator<uint16> requestIdGenerator;
+		/// Lookup routing mode
+		LookupMode lookupMode;
 
-		/// Request map
-		Map<uint16, RequestCallback> callbacks;
+		/// Min delay before a recursive lookup
+		/// is sent to a second hop, 0 if disabled
+		float32 hedgeDelay;
 
-		/// The index of the finger we'll update
-		uint32 nextFinger;
+		/// Current finger refresh period (seconds),
+		/// shrinks while fingers keep changing
+		float32 fingersPeriod;
+
+		/// Time of next finger refresh
+		float64 nextFingersTime;
+
+		/// Fingers changed since last refresh
+		Atomic<uint32> numFingerChanges;
+
+		/// Estimated number of nodes in the ring,
+		/// updated by the receive task and read
+		/// by lookups on any thread
+		Atomic<uint32> ringSize;
+
+		/// Index of the first meaningful finger,
+		/// lower ones are owned by successor
+		Atomic<uint32> firstFinger;
+
+		/// Live nodes that may replace a finger
+		struct CandidateSet
+		{
+			/// Candidates of the i-th finger,
+			/// all in [id + 2^i, id + 2^(i+1))
+			NodeInfo nodes[MAX_CANDIDATES];
+
+			/// Number of candidates
+			uint32 count;
+		};
+
+		/// Candidates of meaningful fingers only,
+		/// from the last finger backward, so that
+		/// memory scales with log2 of ring size
+		CandidateSet * candidates;
+
+		/// Number of candidate sets
+		uint32 numCandidateSets;
+
+		/// Load of this node
+		Load load;
+
+		/// Request rate advertised by
+		/// successor (requests/s)
+		float32 successorLoad;
+
+		/// Requests handled at the last sample
+		uint64 lastNumRequests;
+
+		/// Time of last load sample
+		float64 lastLoadTime;
+
+		/// Time of last move
+		float64 lastMoveTime;
+
+		/// Whether node moves its id
+		/// to shed load
+		bool bLoadBalancing;
+
+		/// Keys owned by this node, in
+		/// range (predecessor, self], and
+		/// replicas of preceding nodes
+		KeyStore store;
+
+		/// Number of successors that hold
+		/// a copy of our keys
+		uint32 numReplicas;
+
+		/// Number of replica acks a
+		/// write waits for
+		uint32 writeQuorum;
+
+		/// Ranges we hold replicas of, as
+		/// advertised by our predecessor
+		RangeDigest replicaRanges[MAX_SUCCESSORS];
+
+		/// Number of replica ranges
+		uint32 numReplicaRanges;
+
+		/// A key handed off to another node
+		struct Handoff
+		{
+			/// Node that takes over key
+			NodeInfo node;
+
+			/// Key to send
+			uint32 key;
+
+			/// Checksum of value sent, key is
+			/// not removed if value changes
+			uint32 checksum;
+
+			/// Request flags
+			uint32 flags;
+
+			/// Number of sends so far
+			uint32 numAttempts;
+
+			/// Whether key is kept once acked
+			bool bKeep;
+		};
+
+		/// Keys waiting to be sent
+		Array<Handoff> handoffs;
+
+		/// Keys sent and waiting for an ack
+		Handoff sentHandoffs[HANDOFF_WINDOW];
+
+		/// Free slots of sent keys
+		uint32 freeHandoffs[HANDOFF_WINDOW];
+
+		/// Number of free slots
+		uint32 numFreeHandoffs;
+
+		/// Keys acked since node started
+		/// leaving the ring
+		uint32 numHandedOff;
+
+		/// Whether node is leaving the ring
+		bool bLeaving;
+
+		/// Set once all keys are handed
+		/// off, if node is leaving
+		Promise<uint32> leaving;
+
+		/// Writes waiting for the store
+		/// to sync them, oldest first
+		SharedPtr<ReplicatedWrite> syncsHead;
+
+		/// Newest write waiting for a sync
+		ReplicatedWrite * syncsTail;
+
+		/// Called when a request is registered,
+		/// so that its timeout gets checked
+		Function<void()> onRequest;
+
+		/// Called after a store write, so
+		/// that the store gets synced
+		Function<void()> onWrite;
 
 		/// Mutex variables
 		/// @{
 		CriticalSection predecessorGuard;
-		CriticalSection fingersGuard[32];
-		CriticalSection callbacksGuard;
+		CriticalSection successorsGuard;
+		CriticalSection fingersGuard;
+		CriticalSection lookupsGuard;
+		CriticalSection candidatesGuard;
+		CriticalSection replicasGuard;
+		CriticalSection handoffsGuard;
+		CriticalSection syncsGuard;
 		/// @}
 	
 	public:
-		/// Default constructor
-		LocalNode();
+		/**
+		 * Create node on a bound socket
+		 * 
+		 * @param [in] socket node socket
+		 * @param [in] index index of virtual
+		 * 	node, gives it a distinct id
+		 * @param [in] maxRequests max number
+		 * 	of pending requests
+		 */
+		LocalNode(SocketDgram & socket, uint32 index = 0U, uint32 maxRequests = DEFAULT_MAX_REQUESTS);
+
+		/// Destructor
+		~LocalNode();
 		
 		/// Get node public address
 		FORCE_INLINE const Ipv4 & getPublicAddress() const
@@ -72,6 +400,107 @@ namespace Chord
 			return self.addr;
 		}
 
+		/// Returns network coordinate of node
+		FORCE_INLINE const NetCoord & getCoord() const
+		{
+			return self.coord;
+		}
+
+		/// Returns RTT to node predicted from
+		/// the network coordinates
+		FORCE_INLINE float32 predictRtt(const NodeInfo & node) const
+		{
+			return self.coord.getDistance(node.coord);
+		}
+
+		/// Returns true if coordinate has settled
+		/// enough to predict RTTs from it. Nodes
+		/// start at the origin with max error
+		static FORCE_INLINE bool isTrusted(const NetCoord & coord)
+		{
+			return coord.isValid() && coord.error < MAX_COORD_ERROR;
+		}
+
+		/// Returns true if RTT to node can be
+		/// predicted from the coordinates
+		FORCE_INLINE bool canPredictRtt(const NodeInfo & node) const
+		{
+			return isTrusted(self.coord) && isTrusted(node.coord);
+		}
+
+		/// Returns load of node
+		FORCE_INLINE const Load & getLoad() const
+		{
+			return load;
+		}
+
+		/// Returns fraction of ring owned by node
+		FORCE_INLINE float32 getRangeSize() const
+		{
+			return predecessor.id == id ? 1.f : (uint32)(id - predecessor.id) / 4294967296.f;
+		}
+
+		/// Enable or disable moving the
+		/// node id to shed load
+		FORCE_INLINE void setLoadBalancing(bool bEnabled)
+		{
+			bLoadBalancing = bEnabled;
+		}
+
+		/// Returns estimated number of nodes in the ring
+		FORCE_INLINE uint32 getRingSize() const
+		{
+			return ringSize.load(AtomicOrder::Relaxed);
+		}
+
+		/// Returns number of fingers maintained
+		FORCE_INLINE uint32 getNumFingers() const
+		{
+			return 32U - firstFinger.load(AtomicOrder::Relaxed);
+		}
+
+		/// Set lookup routing mode
+		FORCE_INLINE void setLookupMode(LookupMode mode)
+		{
+			lookupMode = mode;
+		}
+
+		/// Set min delay of hedged lookups (seconds),
+		/// 0 disables hedging. The actual delay
+		/// follows the RTT of the first hop
+		FORCE_INLINE void setHedgeDelay(float32 delay)
+		{
+			hedgeDelay = delay;
+		}
+
+		/**
+		 * Set replication of owned keys
+		 * 
+		 * @param [in] _numReplicas number of
+		 * 	successors that hold a copy, 0
+		 * 	disables replication
+		 * @param [in] _writeQuorum number of
+		 * 	replica acks a write waits for
+		 */
+		FORCE_INLINE void setReplication(uint32 _numReplicas, uint32 _writeQuorum)
+		{
+			numReplicas = _numReplicas < MAX_SUCCESSORS ? _numReplicas : MAX_SUCCESSORS;
+			writeQuorum = _writeQuorum < numReplicas ? _writeQuorum : numReplicas;
+		}
+
+		/**
+		 * Keep owned keys on disk in directory.
+		 * Keys already there are served right
+		 * away, those we don't own are routed
+		 * to their owner once we learn our
+		 * predecessor. Must be called before
+		 * joining the ring
+		 * 
+		 * @param [in] path store directory
+		 * @return true if store was opened
+		 */
+		bool openStore(const char * path);
+
 		//////////////////////////////////////////////////
 		// Thread-safe setters
 		//////////////////////////////////////////////////
@@ -79,14 +508,13 @@ namespace Chord
 		/// Set finger
 		FORCE_INLINE void setFinger(const NodeInfo & node, uint32 i)
 		{
-			ScopeLock _(fingersGuard + i);
+			ScopeLock _(&fingersGuard);
 			fingers[i] = node;
 		}
 
 		/// Set successor
 		FORCE_INLINE void setSuccessor(const NodeInfo & node)
 		{
-			ScopeLock _(fingersGuard + 0U);
 			setFinger(node, 0);
 		}
 
@@ -96,9 +524,21 @@ namespace Chord
 			predecessor = node;
 		}
 
+		/// Get a copy of finger
+		FORCE_INLINE NodeInfo getFinger(uint32 i)
+		{
+			ScopeLock _(&fingersGuard);
+			return fingers[i];
+		}
+
 	protected:
-		/// Node initialization
-		bool init();
+		/**
+		 * Node initialization
+		 * 
+		 * @param [in] index index of virtual node
+		 * @return true if socket is bound
+		 */
+		bool init(uint32 index);
 	
 	protected:
 		/**
@@ -109,11 +549,78 @@ namespace Chord
 		 */
 		const NodeInfo & findSuccessor(uint32 key) const;
 
+		/**
+		 * Register a pending request and
+		 * arm its deadline
+		 * 
+		 * @param [in] callback request callback
+		 * @param [in] timeout reply timeout (seconds)
+		 * @param [in] numUnits number of reply units expected
+		 * @return request id or invalid id
+		 */
+		uint32 registerRequest(RequestCallback && callback, float32 timeout, uint32 numUnits = 1U);
+
+		/**
+		 * Acquire reply units of a pending
+		 * request, and cancel its deadline
+		 * if no other reply is expected
+		 * 
+		 * @param [in] reqId request id
+		 * @param [in] numUnits number of reply units
+		 * @param [out] callback request callback
+		 * @return true if request was pending
+		 */
+		bool acquireRequest(uint32 reqId, uint32 numUnits, RequestCallback & callback);
+
+		/**
+		 * Remove a pending request and
+		 * cancel its deadline
+		 * 
+		 * @param [in] reqId request id
+		 * @return true if request was pending
+		 */
+		bool cancelRequest(uint32 reqId);
+
+		/**
+		 * Returns timeout of a recursive lookup,
+		 * scaled by the expected number of hops
+		 * 
+		 * @param [in] next first hop
+		 * @return reply timeout (seconds)
+		 */
+		float32 getLookupTimeout(const NodeInfo & next);
+
+		/**
+		 * Returns delay before a recursive lookup
+		 * is sent to a second hop, about the 95th
+		 * percentile of the lookup latency
+		 * 
+		 * @param [in] next first hop
+		 * @return hedge delay (seconds)
+		 */
+		float32 getHedgeDelay(const NodeInfo & next);
+
+		/**
+		 * Find the best preceding node for
+		 * key, other than the given node
+		 * 
+		 * @param [in] key key to lookup
+		 * @param [in] other node to skip
+		 * @return alternative hop or null
+		 */
+		const NodeInfo * findAlternateHop(uint32 key, const NodeInfo & other) const;
+
 		/**
 		 * Forge a request spawning from this node
 		 * 
 		 * @param [in] type request type
 		 * @param [in] recipient request target
+		 * @param [in] onSuccess called when reply is received
+		 * @param [in] onError called if no reply is received in time,
+		 * 	if null the recipient is checked instead
+		 * @param [in] timeout reply timeout (seconds),
+		 * 	0 to use the estimated timeout of recipient
+		 * @param [in] ttl max hop count
 		 * @return forged request
 		 */
 		Request makeRequest(
@@ -121,6 +628,7 @@ namespace Chord
 			const NodeInfo & recipient,
 			RequestCallback::CallbackT && onSuccess = nullptr,
 			RequestCallback::ErrorT && onError = nullptr,
+			float32 timeout = 0.f,
 			uint32 ttl = (uint32)-1
 		);
 
@@ -130,15 +638,32 @@ namespace Chord
 		//////////////////////////////////////////////////
 
 		/**
-		 * Join chord ring (blocking operation)
+		 * Join chord ring (blocking operation).
+		 * The finger table is seeded from the
+		 * one of the successor and verified in
+		 * the background. Replies are handled
+		 * by the receive task, which must be
+		 * already running
 		 * 
 		 * @param [in] peer address of a known peer
+		 * @param [in] numAttempts max number of
+		 * 	lookups sent, the timeout doubles
+		 * 	after each attempt
 		 * @return join status
 		 */
-		bool join(const Ipv4 & peer);
+		bool join(const Ipv4 & peer, uint32 numAttempts = 3U);
 
 		/**
-		 * Look up key in chord ring
+		 * Look up key in chord ring. Concurrent
+		 * lookups of the exact same key share
+		 * the same request and future. Lookups
+		 * of other keys in the same range still
+		 * send their own request, since the
+		 * range is only known once resolved,
+		 * but they complete with the first reply
+		 * that covers them. Keys in a recently
+		 * resolved range are answered from the
+		 * location cache
 		 * 
 		 * @param [in] key key to lookup
 		 * @return future successor info
@@ -146,21 +671,259 @@ namespace Chord
 		Promise<NodeInfo> lookup(uint32 key);
 
 		/**
-		 * Leave chord ring
+		 * Look up many keys at once. Keys are
+		 * grouped by next hop, and each group
+		 * travels in a single datagram. Keys
+		 * that could not be resolved are set
+		 * to an invalid peer
+		 * 
+		 * @param [in] keys keys to lookup
+		 * @param [in] numKeys number of keys
+		 * @param [out] results successor of each key,
+		 * 	must stay valid until future is complete
+		 * @return future completion
+		 */
+		Promise<void> lookupMany(const uint32 * keys, uint32 numKeys, NodeInfo * results);
+
+		/**
+		 * Store value of key on its owner
+		 * 
+		 * @param [in] key key to write
+		 * @param [in] data value buffer
+		 * @param [in] size size of value (bytes),
+		 * 	at most KeyStore::MAX_VALUE_SIZE
+		 * @return future true if value was stored
+		 */
+		Promise<bool> put(uint32 key, const void * data, uint32 size);
+
+		/**
+		 * Read value of key from its owner
+		 * 
+		 * @param [in] key key to read
+		 * @param [out] data value buffer
+		 * @param [in,out] size size of buffer, then
+		 * 	size of value. Both must stay valid
+		 * 	until future is complete
+		 * @return future true if key was found
 		 */
-		void leave();
+		Promise<bool> get(uint32 key, void * data, uint32 & size);
+
+		/**
+		 * Remove key from its owner
+		 * 
+		 * @param [in] key key to remove
+		 * @return future true if key was found
+		 */
+		Promise<bool> remove(uint32 key);
+
+		/**
+		 * Leave chord ring, keys are
+		 * handed off to successor
+		 * 
+		 * @return future number of keys
+		 * 	acked by successor, set once
+		 * 	no handoff is pending
+		 */
+		Promise<uint32> leave();
 
 	protected:
+		/**
+		 * Tell successor and predecessor we
+		 * are leaving, so that they splice
+		 * the ring around us
+		 */
+		void sendLeave();
+
 		/**
 		 * Stabilize node and notify successor
 		 */
 		void stabilize();
 
 		/**
-		 * Fix current next finger
+		 * Refresh finger table if due. The
+		 * period adapts to how many fingers
+		 * changed since the last refresh
 		 */
 		void fixFingers();
 
+		/**
+		 * Refresh all fingers at once. Fingers
+		 * that fall in the successor range, in
+		 * a fresh cached range or in the range
+		 * of a lookup already sent are skipped
+		 */
+		void refreshFingers();
+
+		/**
+		 * Lookup and update i-th finger, the
+		 * reply also updates the following
+		 * fingers owned by the same node
+		 * 
+		 * @param [in] i finger index
+		 */
+		void fixFinger(uint32 i);
+
+		/**
+		 * Update i-th finger with the owner of
+		 * its key, counts the change if node
+		 * is different. If the owner falls in
+		 * the finger slot, the closest of the
+		 * slot candidates is kept
+		 * 
+		 * @param [in] node owner of finger key
+		 * @param [in] i finger index
+		 */
+		void updateFinger(const NodeInfo & node, uint32 i);
+
+		/**
+		 * Replace fingers for which peer is a
+		 * closer successor of the finger key,
+		 * and add it to the candidates of the
+		 * finger slot it falls in. Peers come
+		 * from observed traffic
+		 * 
+		 * @param [in] peer live peer
+		 */
+		void learnPeer(const NodeInfo & peer);
+
+		/// Returns candidates of i-th finger, or
+		/// null if finger is not meaningful. Must
+		/// be called with candidates locked
+		FORCE_INLINE CandidateSet * getCandidates(uint32 i)
+		{
+			return i < 32 && 31 - i < numCandidateSets ? candidates + (31 - i) : nullptr;
+		}
+
+		/**
+		 * Resize candidates to the number of
+		 * meaningful fingers, candidates of
+		 * fingers that are kept are preserved
+		 */
+		void resizeCandidates();
+
+		/**
+		 * Add node to the candidates of the
+		 * i-th finger, probes its RTT if it
+		 * was never sampled
+		 * 
+		 * @param [in] node node in finger slot
+		 * @param [in] i finger index
+		 */
+		void addCandidate(const NodeInfo & node, uint32 i);
+
+		/**
+		 * Remove node from all candidates
+		 * 
+		 * @param [in] node node to remove
+		 */
+		void removeCandidate(const NodeInfo & node);
+
+		/**
+		 * Set i-th finger to the candidate with
+		 * the lowest RTT, if the current finger
+		 * falls in the finger slot. Any node in
+		 * the slot takes the same number of hops
+		 * 
+		 * @param [in] i finger index
+		 * @return true if finger changed
+		 */
+		bool selectFinger(uint32 i);
+
+		/**
+		 * Returns RTT of node used to rank
+		 * candidates, predicted from network
+		 * coordinates if never sampled. Nodes
+		 * with no coordinate rank last
+		 * 
+		 * @param [in] node candidate node
+		 * @return RTT (seconds)
+		 */
+		float32 getProximity(const NodeInfo & node);
+
+		/**
+		 * Seed finger table from the nodes
+		 * known by our successor
+		 * 
+		 * @param [in] nodes known nodes
+		 * @param [in] numNodes number of nodes
+		 */
+		void seedFingers(const NodeInfo * nodes, uint32 numNodes);
+
+		/**
+		 * Get successor and the nodes that
+		 * follow it
+		 * 
+		 * @param [out] list successor list,
+		 * 	at least MAX_SUCCESSORS entries
+		 * @return number of nodes in list
+		 */
+		uint32 getSuccessorList(NodeInfo * list);
+
+		/**
+		 * Update successor list from the
+		 * list of a successor node
+		 * 
+		 * @param [in] node successor node
+		 * @param [in] list successor list of node
+		 * @param [in] n number of nodes in list
+		 */
+		void updateSuccessorList(const NodeInfo & node, const NodeInfo * list, uint32 n);
+
+		/**
+		 * Estimate ring size from the span of
+		 * the successor list, and derive the
+		 * number of fingers worth maintaining.
+		 * Called with successor list locked
+		 */
+		void estimateRingSize();
+
+		/**
+		 * Sample load if due. If enabled, move
+		 * node toward its predecessor when it is
+		 * much more loaded than its successor,
+		 * so that successor takes over part of
+		 * its range
+		 */
+		void balanceLoad();
+
+		/**
+		 * Compact persistent store, at
+		 * most one segment per call
+		 */
+		void compactStore();
+
+		/**
+		 * Sync persistent store and complete
+		 * the writes of the synced batch
+		 */
+		void flushStore();
+
+		/// Returns true if some store write
+		/// is not synced or not replied yet
+		bool hasPendingWrites();
+
+		/**
+		 * Move node to a lower id: hand off keys
+		 * in (newId, id] to successor, leave the
+		 * ring, reset routing state and join
+		 * again through the old successor. Only
+		 * called by the receive task, the old id
+		 * is kept to route pending replies
+		 * 
+		 * @param [in] newId new node id
+		 */
+		void moveTo(uint32 newId);
+
+		/**
+		 * Join ring again after a move, without
+		 * blocking. A lookup that times out is
+		 * sent again
+		 * 
+		 * @param [in] peer node to join through
+		 * @param [in] numAttempts max number of lookups
+		 */
+		void rejoin(const NodeInfo & peer, uint32 numAttempts);
+
 		/**
 		 * Remove remote node from the local view
 		 * 
@@ -181,11 +944,247 @@ namespace Chord
 		void checkPredecessor();
 
 		/**
-		 * Check expired requests
+		 * Advance requests deadlines and
+		 * run error callback of expired ones
+		 */
+		void checkRequests();
+
+		/// Returns true if some request
+		/// is waiting for a reply
+		FORCE_INLINE bool hasPendingRequests() const
+		{
+			return requests.getCount() > 0;
+		}
+
+		/**
+		 * Returns lookup in flight, must be
+		 * called with lookups locked
+		 * 
+		 * @param [in] key looked up key
+		 * @param [in] seq lookup sequence number
+		 * @return lookup or null if it completed
+		 */
+		FORCE_INLINE PendingLookup * findLookup(uint32 key, uint32 seq)
+		{
+			auto it = lookups.find(key);
+			return it != lookups.nil() && it->second.seq == seq ? &it->second : nullptr;
+		}
+
+		/**
+		 * Send next step of an iterative lookup,
+		 * retries the step around hops that
+		 * don't reply in time
 		 * 
-		 * @param [in] dt delta time from last check
+		 * @param [in] key looked up key
+		 * @param [in] seq lookup sequence number
+		 * @param [in] hop node to ask
 		 */
-		void checkRequests(float32 dt);
+		void stepLookup(uint32 key, uint32 seq, const NodeInfo & hop);
+
+		/**
+		 * Send recursive lookup to hop, and
+		 * race a duplicate to the alternative
+		 * hop if no reply is received in time
+		 * 
+		 * @param [in] key looked up key
+		 * @param [in] seq lookup sequence number
+		 * @param [in] hop first hop
+		 * @param [in] alt alternative hop
+		 */
+		void hedgeLookup(uint32 key, uint32 seq, const NodeInfo & hop, const NodeInfo & alt);
+
+		/**
+		 * Create one of the two requests
+		 * of a hedged lookup
+		 * 
+		 * @param [in] key looked up key
+		 * @param [in] seq lookup sequence number
+		 * @param [in] hop request recipient
+		 * @param [in] i request index
+		 * @return lookup request
+		 */
+		Request makeHedgedLookup(uint32 key, uint32 seq, const NodeInfo & hop, uint32 i);
+
+		/**
+		 * Fail lookup of key with an invalid peer
+		 * 
+		 * @param [in] key looked up key
+		 * @param [in] out lookup future
+		 */
+		void failLookup(uint32 key, Promise<NodeInfo> out);
+
+		/**
+		 * Complete lookup of key and all lookups
+		 * in flight whose key falls in the range
+		 * resolved by the reply
+		 * 
+		 * @param [in] key looked up key
+		 * @param [in] res lookup reply
+		 */
+		void completeLookups(uint32 key, const Request & res);
+
+		/**
+		 * Send a data request to the owner of
+		 * key, or execute it if we own the key
+		 * 
+		 * @param [in] type PUT, GET or REMOVE
+		 * @param [in] key target key
+		 * @param [in] data value to write
+		 * @param [in] size size of value
+		 * @param [out] out value read
+		 * @param [in,out] outSize size of value read
+		 * @return future result
+		 */
+		Promise<bool> sendData(Request::Type type, uint32 key, const void * data, uint32 size, void * out, uint32 * outSize);
+
+		/**
+		 * Execute a data request on the
+		 * local store
+		 * 
+		 * @return request result
+		 * @see sendData
+		 */
+		bool executeData(Request::Type type, uint32 key, const void * data, uint32 size, void * out, uint32 * outSize);
+
+		/**
+		 * Copy a write executed locally to the
+		 * replicas of key, and complete it once
+		 * enough of them ack
+		 * 
+		 * @param [in] type PUT or REMOVE
+		 * @param [in] key target key
+		 * @param [in] data value to write
+		 * @param [in] size size of value
+		 * @param [in] write write state, holds
+		 * 	the reply or the future result
+		 */
+		void replicateData(Request::Type type, uint32 key, const void * data, uint32 size, SharedPtr<ReplicatedWrite> write);
+
+		/**
+		 * Complete a write executed locally
+		 * once it is synced, if the store is
+		 * persistent, and once replicas ack
+		 * it, if it is replicated
+		 * 
+		 * @param [in] type PUT or REMOVE
+		 * @param [in] key target key
+		 * @param [in] data value to write
+		 * @param [in] size size of value
+		 * @param [in] write write state, holds
+		 * 	the reply or the future result
+		 * @param [in] bReplicate whether write
+		 * 	is copied to replicas
+		 */
+		void commitData(Request::Type type, uint32 key, const void * data, uint32 size, SharedPtr<ReplicatedWrite> write, bool bReplicate);
+
+		/**
+		 * Returns the node closest to node
+		 * among our successor and the nodes
+		 * that hold its replicas
+		 * 
+		 * @param [in] node requesting node
+		 * @return closest replica
+		 */
+		NodeInfo getNearestReplica(const NodeInfo & node);
+
+		/**
+		 * Send the keys we hold in range to
+		 * node, which sends back the keys we
+		 * lack and pulls the ones it lacks
+		 * 
+		 * @param [in] node replica to sync with
+		 * @param [in] range range to sync
+		 */
+		void sendSync(const NodeInfo & node, const RangeDigest & range);
+
+		/**
+		 * Queue keys in range (start, end] to
+		 * be sent to node. Each key is removed
+		 * from the local store only once node
+		 * acks it, see @ref sendHandoffs
+		 * 
+		 * @param [in] node new owner of keys
+		 * @param [in] start,end range of keys,
+		 * 	all keys if start equals end
+		 * @param [in] bForce if false, node
+		 * 	forwards keys it doesn't own
+		 * @param [in] bKeep if true, keys are
+		 * 	kept as replicas
+		 * @return number of keys queued
+		 */
+		uint32 handOffKeys(const NodeInfo & node, uint32 start, uint32 end, bool bForce = true, bool bKeep = false);
+
+		/**
+		 * Send queued keys as PUT requests,
+		 * at most @ref HANDOFF_WINDOW at a time
+		 * so that a large range doesn't flood
+		 * the socket and the request table
+		 */
+		void sendHandoffs();
+
+		/**
+		 * Complete a sent key: remove it if
+		 * acked, else send it again until
+		 * attempts run out
+		 * 
+		 * @param [in] slot slot of sent key
+		 * @param [in] bAcked whether node
+		 * 	stored key
+		 */
+		void finishHandoff(uint32 slot, bool bAcked);
+
+		/**
+		 * Returns whether key falls in
+		 * the range we own
+		 */
+		FORCE_INLINE bool isOwner(uint32 key) const
+		{
+			return predecessor.id == id ? successor.id == id : rangeOpenClosed(key, predecessor.id, id);
+		}
+
+		/**
+		 * Returns whether a key handed off by
+		 * src is ours: it falls in our range,
+		 * or src is our predecessor leaving the
+		 * ring, or we don't know our predecessor
+		 * yet and key is not in the src range
+		 */
+		FORCE_INLINE bool isHandedOff(uint32 key, const NodeInfo & src) const
+		{
+			if (predecessor.id == id) return !rangeOpenClosed(key, id, src.id);
+			return src.id == predecessor.id || rangeOpenClosed(key, predecessor.id, id);
+		}
+
+		/**
+		 * Returns whether key falls in one of
+		 * the ranges we replicate, as last
+		 * advertised by our predecessor
+		 */
+		bool isReplica(uint32 key);
+
+		/**
+		 * Returns next hop of a data
+		 * request for key
+		 */
+		FORCE_INLINE const NodeInfo & getDataHop(uint32 key) const
+		{
+			return rangeOpenClosed(key, id, successor.id) ? successor : findSuccessor(key);
+		}
+
+		/**
+		 * Resolve keys that are owned by our
+		 * successor and forward the others,
+		 * grouped by next hop
+		 * 
+		 * @param [in] req batch request
+		 * @param [in] keys keys to route
+		 * @param [in] numKeys number of keys
+		 * @param [out] resolved keys resolved locally
+		 * @param [out] hops distinct next hops, at most 33
+		 * @param [out] numHops number of next hops
+		 * @return number of keys resolved locally
+		 */
+		uint32 routeLookups(const Request & req, const LookupKey * keys, uint32 numKeys, LookupResult * resolved, NodeInfo * hops = nullptr, uint32 * numHops = nullptr);
 
 	protected:
 		/**
@@ -197,9 +1196,14 @@ namespace Chord
 		void handleRequest(const Request & req);
 		void handleReply(const Request & req);
 		void handleLookup(const Request & req);
+		void handleLookupMany(const Request & req);
 		void handleNotify(const Request & req);
 		void handleLeave(const Request & req);
 		void handleCheck(const Request & req);
+		void handleUpdate(const Request & req);
+		void handleFingers(const Request & req);
+		void handleData(const Request & req);
+		void handleSync(const Request & req);
 		/// @}
 		
 	public:
@@ -211,47 +1215,25 @@ namespace Chord
 			printf("# ---- | ----------\n");
 			printf("# pred | %s\n", predecessor.id == id ? "self" : *predecessor.getInfoString());
 			printf("# succ | %s\n", successor.id == id ? "self" : *successor.getInfoString());
+			printf("# size | ~%u nodes, %u fingers\n", getRingSize(), getNumFingers());
+			printf("# load | %.1f req/s, %u keys, %.2f%% of ring, succ %.1f req/s\n", load.rate, load.numKeys, getRangeSize() * 100.f, successorLoad);
+			printf("# keys | %u%s, %u replicas, write quorum %u\n", store.getCount(), store.isPersistent() ? ", on disk" : "", numReplicas, writeQuorum);
+			printf("# crd  | (%.2f, %.2f) + %.2f ms, error = %.2f\n", self.coord.pos[0] * 1000.f, self.coord.pos[1] * 1000.f, self.coord.height * 1000.f, self.coord.error);
+
+			for (uint32 i = 0; i < numSuccessors; ++i)
+				printf("# next | %s\n", *successors[i].getInfoString());
 
-			for (uint32 i = 1; i < 32; ++i)
+			for (uint32 i = firstFinger; i < 32; ++i)
 				printf("#   %02u | %s\n", i, fingers[i].id == id ? "self" : *fingers[i].getInfoString());
 		}
 
 	protected:
-		/**
-		 * Returns whether number falls in (circular) range or not
-		 * 
-		 * @param [in] n test variable
-		 * @param [in] a,b range delimiters
-		 * @return true if test variables falls in range
-		 * @{
-		 */
-		template<typename T>
-		static FORCE_INLINE bool rangeOpen(T n, T a, T b)
-		{
-			return	(a < b && (n > a && n < b)) ||
-					(a > b && (n > a || n < b));
-		}
-		
-		template<typename T>
-		static FORCE_INLINE bool rangeClosed(T n, T a, T b)
+		/// Returns whether node falls in the
+		/// slot of the i-th finger, that is
+		/// [id + 2^i, id + 2^(i+1))
+		FORCE_INLINE bool isInSlot(const NodeInfo & node, uint32 i) const
 		{
-			return	(a < b && (n >= a && n <= b)) ||
-					(a > b && (n >= a || n <= b));
+			return node.id != id && rangeClosedOpen(node.id, id + (1U << i), id + (2U << i));
 		}
-		
-		template<typename T>
-		static FORCE_INLINE bool rangeOpenClosed(T n, T a, T b)
-		{
-			return	(a < b && (n > a && n <= b)) ||
-					(a > b && (n > a || n <= b));
-		}
-		
-		template<typename T>
-		static FORCE_INLINE bool rangeClosedOpen(T n, T a, T b)
-		{
-			return	(a < b && (n >= a && n < b)) ||
-					(a > b && (n >= a || n < b));
-		}
-		/// @}
 	};
 } // namespace Chord
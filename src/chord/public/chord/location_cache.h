@@ -0,0 +1,115 @@
+#pragma once
+
+#include "coremin.h"
+#include "hal/critical_section.h"
+#include "misc/time.h"
+
+#include "chord_fwd.h"
+#include "types.h"
+
+namespace Chord
+{
+	/**
+	 * @class LocationCache chord/location_cache.h
+	 *
+	 * A bounded cache of resolved key ranges.
+	 * Each range (start, owner] maps to the node
+	 * that owns it. Ranges are kept sorted by
+	 * owner id, so that a key is found with a
+	 * binary search
+	 *
+	 * Fresh ranges can be trusted as they are,
+	 * older ones are just a hint of where to
+	 * start looking. When full, the least
+	 * recently refreshed range is evicted
+	 */
+	class LocationCache
+	{
+	public:
+		/// A cached range
+		struct Range
+		{
+			/// Predecessor of owner, excluded
+			NodeInfo start;
+
+			/// Owner of the range
+			NodeInfo owner;
+
+			/// Time range was resolved
+			float64 time;
+		};
+
+	protected:
+		/// Ranges sorted by owner id
+		Range * ranges;
+
+		/// Number of cached ranges
+		uint32 numRanges;
+
+		/// Max number of cached ranges
+		uint32 maxRanges;
+
+		/// Max age of a fresh range (seconds)
+		float32 maxAge;
+
+		/// Guards ranges
+		mutable RWLock guard;
+
+	public:
+		/**
+		 * Default constructor
+		 *
+		 * @param [in] maxRanges max number of cached ranges
+		 * @param [in] maxAge max age of a fresh range (seconds)
+		 */
+		LocationCache(uint32 maxRanges = 256U, float32 maxAge = 2.f);
+
+		/// Destructor
+		~LocationCache();
+
+		/// Returns number of cached ranges
+		FORCE_INLINE uint32 getCount() const
+		{
+			return numRanges;
+		}
+
+		/// Returns whether range was resolved recently
+		FORCE_INLINE bool isFresh(const Range & range) const
+		{
+			return getTime() - range.time < maxAge;
+		}
+
+		/**
+		 * Find range that contains key
+		 *
+		 * @param [in] key key to find
+		 * @param [out] range cached range
+		 * @return true if key is in a cached range
+		 */
+		bool find(uint32 key, Range & range) const;
+
+		/**
+		 * Insert a resolved range, overlapping
+		 * ranges are replaced
+		 *
+		 * @param [in] start predecessor of owner
+		 * @param [in] owner owner of the range
+		 */
+		void insert(const NodeInfo & start, const NodeInfo & owner);
+
+		/**
+		 * Remove all ranges that refer to node
+		 *
+		 * @param [in] node failed node
+		 */
+		void invalidate(const NodeInfo & node);
+
+	protected:
+		/// Returns index of first range
+		/// whose owner id is not less than id
+		uint32 lowerBound(uint32 id) const;
+
+		/// Remove range at index
+		void removeAt(uint32 i);
+	};
+} // namespace Chord
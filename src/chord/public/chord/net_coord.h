@@ -0,0 +1,65 @@
+#pragma once
+
+#include "coremin.h"
+
+namespace Chord
+{
+	/**
+	 * @struct NetCoord chord/net_coord.h
+	 *
+	 * A synthetic network coordinate (Vivaldi),
+	 * a 2D euclidean position plus a height
+	 * that models the access link. The distance
+	 * between two coordinates predicts the RTT
+	 * between the two nodes
+	 *
+	 * Coordinates travel with node infos, so
+	 * that the RTT of a node can be predicted
+	 * before we talk to it. A coordinate with
+	 * no error has never been set
+	 */
+	struct NetCoord
+	{
+	public:
+		/// Position (seconds)
+		float32 pos[2];
+
+		/// Height (seconds)
+		float32 height;
+
+		/// Relative error of coordinate,
+		/// 0 if coordinate is not set
+		float32 error;
+
+	public:
+		/// Returns whether coordinate is set
+		FORCE_INLINE bool isValid() const
+		{
+			return error > 0.f;
+		}
+
+		/**
+		 * Returns predicted RTT between
+		 * the two coordinates
+		 * 
+		 * @param [in] other other coordinate
+		 * @return predicted RTT (seconds)
+		 */
+		FORCE_INLINE float32 getDistance(const NetCoord & other) const
+		{
+			const float32 dx = pos[0] - other.pos[0];
+			const float32 dy = pos[1] - other.pos[1];
+
+			return PlatformMath::sqrt(dx * dx + dy * dy) + height + other.height;
+		}
+
+		/**
+		 * Move coordinate according to a RTT
+		 * sample to a remote node
+		 * 
+		 * @param [in] remote coordinate of remote node
+		 * @param [in] rtt measured round-trip time (seconds)
+		 */
+		void update(const NetCoord & remote, float32 rtt);
+	};
+} // namespace Chord
@@ -2,6 +2,7 @@
 
 #include "hal/runnable.h"
 
+#include "net/event_loop.h"
 #include "chord_fwd.h"
 
 namespace Chord
@@ -9,17 +10,34 @@ namespace Chord
 	/**
 	 * @class ReceiveTask chord/receive_task.h
 	 * 
-	 * Receives and process incoming messages in a separate thread
+	 * Receives and process incoming messages and
+	 * runs periodic node maintenance in a separate
+	 * thread, for all the virtual nodes of a host.
+	 * Socket and maintenance timers share a single
+	 * event loop, so that node state is only
+	 * updated by this thread. Request checks
+	 * only run while some request is pending
 	 */
 	class ReceiveTask : public Runnable
 	{
 	protected:
-		/// Local node that owns this task
-		LocalNode * node;
+		/// Host that owns this task
+		VirtualHost * host;
+
+		/// Event loop, waits on host socket
+		/// and maintenance timers
+		EventLoop loop;
+
+		/// Request checks timer, only armed
+		/// while requests are pending
+		int32 requestsTimer;
+
+		/// True if request checks timer is armed
+		Atomic<bool> bChecking;
 
 	public:
 		/// Default constructor
-		ReceiveTask(LocalNode * _node);
+		ReceiveTask(VirtualHost * _host);
 
 		//////////////////////////////////////////////////
 		// Runnable interface
@@ -30,5 +48,20 @@ namespace Chord
 
 		/// @copydoc Runnable::run
 		virtual int32 run() override;
+
+		/// @copydoc Runnable::stop
+		virtual void stop() override;
+
+	protected:
+		/// Read and process all pending messages
+		void receive();
+
+		/// Arm request checks timer, can be
+		/// called from any thread
+		void armChecks();
+
+		/// Returns true if any node has
+		/// pending requests
+		bool hasPendingRequests() const;
 	};
 } // namespace Chord
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "chord_fwd.h"
+#include "types.h"
 #include "templates/reference.h"
 
 namespace Chord
@@ -19,23 +20,73 @@ namespace Chord
 			LOOKUP,
 			NOTIFY,
 			LEAVE,
-			CHECK
+			CHECK,
+			LOOKUP_MANY,
+			UPDATE,
+			FINGERS,
+			PUT,
+			GET,
+			REMOVE,
+			SYNC
 		};
+
+		/// Request flags
+		enum Flags : uint32
+		{
+			/// Each payload entry accounts
+			/// for a separate reply
+			BATCH = 1 << 0,
+
+			/// Lookup is driven by the source,
+			/// hops reply with the next hop
+			ITERATIVE = 1 << 1,
+
+			/// Reply carries the next hop
+			/// rather than the key owner
+			REFERRAL = 1 << 2,
+
+			/// Keys handed off to a new owner,
+			/// stored by the recipient as they are
+			HANDOFF = 1 << 3,
+
+			/// Key falls in the successor range
+			/// of the sender, recipient owns it
+			LAST_HOP = 1 << 4,
+
+			/// Executed by a replica of the key,
+			/// writes are not replicated further
+			REPLICA = 1 << 5
+		};
+
+		/// Wire format version, bumped on
+		/// incompatible header changes
+		enum : uint32 { VERSION = 4 };
+
+		/// Max size of payload that can follow
+		/// the header in a single datagram
+		enum : uint32 { MAX_PAYLOAD_SIZE = 1280 };
 		
 		/// Request type
 		Type type : 8;
 
+		/// Wire format version
+		uint32 version : 8;
+
 		/// Flags
-		uint32 flags : 8;
+		uint32 flags : 16;
+
+		/// Epoch of the node that issued the request
+		uint32 epoch;
 
-		/// Request id
-		uint32 id : 16;
+		/// Request id, unique within epoch
+		uint32 id;
 
 		/// Destination operand
-		ubyte dst[Math::max(20UL, sizeof(Ipv4))];
+		ubyte dst[Math::max(20UL, sizeof(NodeInfo))];
 
-		/// Source operand
-		ubyte src[Math::max(20UL, sizeof(Ipv4))];
+		/// Source operand, a node info
+		/// carries its network coordinate
+		ubyte src[Math::max(20UL, sizeof(NodeInfo))];
 
 		/// Sender address
 		Ipv4 sender;
@@ -43,13 +94,35 @@ namespace Chord
 		/// Recipient address
 		Ipv4 recipient;
 
+		/// Id of recipient node, tells apart
+		/// virtual nodes sharing an address
+		uint32 target;
+
 		/// Request time to live (ttl)
 		uint32 ttl : 16;
 
 		/// Request hop count
 		uint32 hopCount : 16;
 
+		/// Size of payload (bytes)
+		uint32 payloadSize : 16;
+
+		/// Number of entries in payload
+		uint32 numEntries : 16;
+
 	public:
+		/// Returns whether request uses a known wire format
+		FORCE_INLINE bool isCompatible() const
+		{
+			return version == VERSION;
+		}
+
+		/// Returns size of request with payload (bytes)
+		FORCE_INLINE uint32 getSize() const
+		{
+			return sizeof(Request) + payloadSize;
+		}
+
 		/// Returns whether request is expired
 		FORCE_INLINE bool isExpired() const
 		{
@@ -82,6 +155,28 @@ namespace Chord
 		FORCE_INLINE typename EnableIf<!IsPointer<T>::value, const T&>::Type	getDst() const	{ return *reinterpret_cast<const T*>(dst); }
 		/// @}
 
+		/// Returns payload entries. The payload is
+		/// stored right after the header, see
+		/// @ref RequestBuffer
+		/// @{
+		template<typename T>
+		FORCE_INLINE T *		getPayload()		{ return reinterpret_cast<T*>(this + 1); }
+		template<typename T>
+		FORCE_INLINE const T *	getPayload() const	{ return reinterpret_cast<const T*>(this + 1); }
+		/// @}
+
+		/**
+		 * Sets payload size from entries
+		 * 
+		 * @param [in] n number of entries
+		 */
+		template<typename T>
+		FORCE_INLINE void setPayload(uint32 n)
+		{
+			numEntries = n;
+			payloadSize = n * sizeof(T);
+		}
+
 		/**
 		 * Sets value of source operand
 		 * 
@@ -119,6 +214,82 @@ namespace Chord
 		}
 	};
 
+	/**
+	 * @struct RequestBuffer chord/request.h
+	 * 
+	 * A request followed by its payload
+	 */
+	struct alignas(16) RequestBuffer
+	{
+		/// Request header
+		Request header;
+
+		/// Payload buffer
+		ubyte payload[Request::MAX_PAYLOAD_SIZE];
+	};
+
+	/**
+	 * @struct LookupKey chord/request.h
+	 * 
+	 * A key in a batched lookup request
+	 */
+	struct LookupKey
+	{
+		/// Key to lookup
+		uint32 key;
+
+		/// Index of key in source batch
+		uint32 index;
+	};
+
+	/**
+	 * @struct LookupResult chord/request.h
+	 * 
+	 * A resolved key in a batched lookup reply
+	 */
+	struct LookupResult
+	{
+		/// Index of key in source batch
+		uint32 index;
+
+		/// Successor of key
+		NodeInfo node;
+	};
+
+	/**
+	 * @struct RangeDigest chord/request.h
+	 * 
+	 * Summary of the keys a node holds in
+	 * range (start, end], sent along with
+	 * NOTIFY to compare replicas
+	 */
+	struct RangeDigest
+	{
+		/// Range delimiters
+		uint32 start, end;
+
+		/// Number of keys in range
+		uint32 numKeys;
+
+		/// Sum of key and value hashes
+		uint32 digest;
+	};
+
+	/**
+	 * @struct SyncEntry chord/request.h
+	 * 
+	 * A key held by a replica, sent
+	 * with SYNC
+	 */
+	struct SyncEntry
+	{
+		/// Replica key
+		uint32 key;
+
+		/// Checksum of value
+		uint32 checksum;
+	};
+
 	/**
 	 * @struct RequestCallback chord/request.h
 	 */
@@ -133,49 +304,33 @@ namespace Chord
 
 	public:
 		/// Success callback
-		const CallbackT onSuccess;
+		CallbackT onSuccess;
 
 		/// Error callback
-		const ErrorT onError;
+		ErrorT onError;
 
-	protected:
-		/// Time to live
-		float32 ttl;
+		/// Request recipient, checked if no
+		/// reply is received and there is no
+		/// error callback
+		NodeInfo recipient;
 
-		/// Request current age
-		float32 age;
+		/// Time request was sent, 0 if
+		/// not used for RTT estimation
+		float64 time;
 
 	public:
 		/// Default constructor
 		FORCE_INLINE RequestCallback()
 			: onSuccess{nullptr}
 			, onError{nullptr}
-			, ttl{0.f}
-			, age{0.f} {}
+			, recipient{(uint32)-1, Ipv4::any}
+			, time{0.0} {}
 		
 		/// Callback constructor
-		explicit FORCE_INLINE RequestCallback(CallbackT && _onSuccess, ErrorT && _onError = nullptr, float32 _ttl = 2.f)
+		explicit FORCE_INLINE RequestCallback(CallbackT && _onSuccess, ErrorT && _onError = nullptr)
 			: onSuccess{::move(_onSuccess)}
 			, onError{::move(_onError)}
-			, ttl{_ttl}
-			, age{0.f} {}
-
-		/**
-		 * Tick request
-		 * 
-		 * @param [in] dt time elapsed from last tick
-		 * @return true if request has expired
-		 */
-		FORCE_INLINE bool tick(float32 dt)
-		{
-			age += dt;
-			if (ttl > 0.f && age > ttl)
-			{
-				age -= ttl;
-				return true;
-			}
-
-			return false;
-		}
+			, recipient{(uint32)-1, Ipv4::any}
+			, time{0.0} {}
 	};
 } // Chord
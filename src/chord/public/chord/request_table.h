@@ -0,0 +1,166 @@
+#pragma once
+
+#include "coremin.h"
+
+#include "chord_fwd.h"
+#include "request.h"
+
+namespace Chord
+{
+	/**
+	 * @class RequestTable chord/request_table.h
+	 *
+	 * A fixed-capacity table of pending request
+	 * callbacks, indexed directly by request id.
+	 * Each id encodes the slot index and the slot
+	 * generation, so that stale replies (and
+	 * stale timeouts) are rejected
+	 *
+	 * A request may expect more than one reply,
+	 * in which case it stays pending until all
+	 * its reply units are acquired
+	 *
+	 * Slots are claimed round-robin, so that a
+	 * given id is reused only after capacity
+	 * times the number of generations inserts.
+	 * Insertion and removal are lock-free and
+	 * can be performed concurrently by any
+	 * number of threads
+	 */
+	class RequestTable
+	{
+	public:
+		/// Id that is never assigned to a request
+		enum : uint32 { INVALID_ID = 0U };
+
+	protected:
+		/// Id of a slot being filled or emptied
+		enum : uint32 { BUSY_ID = 0xffffffff };
+
+		/// Attempts to claim a busy slot before
+		/// giving up, slots are only busy for
+		/// the time of a callback copy
+		enum : uint32 { MAX_CLAIM_ATTEMPTS = 64 };
+
+		/// A table slot
+		struct Slot
+		{
+			/// Id of the pending request, or invalid
+			Atomic<uint32> id;
+
+			/// Incremented every time the slot is
+			/// used, zero if never used
+			uint32 generation;
+
+			/// Reply units still expected
+			uint32 numUnits;
+		};
+
+		/// Slots buffer
+		Slot * slots;
+
+		/// Callbacks buffer, a callback is
+		/// constructed when its slot is first used
+		RequestCallback * callbacks;
+
+		/// Number of slots, a power of 2
+		uint32 capacity;
+
+		/// Number of bits used for slot index
+		uint32 indexBits;
+
+		/// Mask of valid id bits
+		uint32 idMask;
+
+		/// Next slot to probe
+		Atomic<uint32> cursor;
+
+		/// Number of pending requests
+		Atomic<uint32> count;
+
+	public:
+		/**
+		 * Default constructor
+		 *
+		 * @param [in] capacity max number of pending requests
+		 * @param [in] idBits width of request id
+		 */
+		RequestTable(uint32 capacity = 1024U, uint32 idBits = 16U);
+
+		/// Destructor
+		~RequestTable();
+
+		/// Returns max number of pending requests
+		FORCE_INLINE uint32 getCapacity() const
+		{
+			return capacity;
+		}
+
+		/// Returns number of pending requests
+		FORCE_INLINE uint32 getCount() const
+		{
+			return count.load(AtomicOrder::Relaxed);
+		}
+
+		/// Returns slot index of a request, that
+		/// no other pending request shares
+		FORCE_INLINE uint32 getIndex(uint32 id) const
+		{
+			return id & (capacity - 1);
+		}
+
+		/// Returns whether the slot of a request
+		/// is busy, in which case the request
+		/// could not be claimed
+		FORCE_INLINE bool isBusy(uint32 id) const
+		{
+			return slots[getIndex(id)].id.load() == BUSY_ID;
+		}
+
+		/**
+		 * Insert a new request callback
+		 *
+		 * @param [in] callback request callback
+		 * @param [in] numUnits number of reply units expected
+		 * @return request id or invalid id if full
+		 */
+		uint32 insert(RequestCallback && callback, uint32 numUnits = 1U);
+
+		/**
+		 * Acquire reply units of a pending
+		 * request. The request is removed when
+		 * all its units have been acquired
+		 *
+		 * @param [in] id request id
+		 * @param [in] numUnits number of reply units
+		 * @param [out] callback request callback
+		 * @param [out] bRemoved true if request was removed
+		 * @return true if request was pending and claimed
+		 */
+		bool acquire(uint32 id, uint32 numUnits, RequestCallback & callback, bool & bRemoved);
+
+		/**
+		 * Remove pending request. Only one
+		 * caller can remove a given request
+		 *
+		 * @param [in] id request id
+		 * @param [out] callback removed callback
+		 * @return true if request was pending and claimed
+		 */
+		bool remove(uint32 id, RequestCallback & callback);
+
+	protected:
+		/**
+		 * Claim slot of a pending request,
+		 * retries a bounded number of times
+		 * if slot is busy
+		 *
+		 * @param [in] id request id
+		 * @return claimed slot or null
+		 */
+		Slot * claim(uint32 id);
+
+		/// Remove callback and release slot
+		void release(Slot * slot, RequestCallback & callback);
+	};
+} // namespace Chord
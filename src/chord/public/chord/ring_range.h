@@ -0,0 +1,43 @@
+#pragma once
+
+#include "coremin.h"
+
+namespace Chord
+{
+	/**
+	 * Returns whether number falls in (circular) range or not
+	 * 
+	 * @param [in] n test variable
+	 * @param [in] a,b range delimiters
+	 * @return true if test variables falls in range
+	 * @{
+	 */
+	template<typename T>
+	FORCE_INLINE bool rangeOpen(T n, T a, T b)
+	{
+		return	(a < b && (n > a && n < b)) ||
+				(a > b && (n > a || n < b));
+	}
+	
+	template<typename T>
+	FORCE_INLINE bool rangeClosed(T n, T a, T b)
+	{
+		return	(a < b && (n >= a && n <= b)) ||
+				(a > b && (n >= a || n <= b));
+	}
+	
+	template<typename T>
+	FORCE_INLINE bool rangeOpenClosed(T n, T a, T b)
+	{
+		return	(a < b && (n > a && n <= b)) ||
+				(a > b && (n > a || n <= b));
+	}
+	
+	template<typename T>
+	FORCE_INLINE bool rangeClosedOpen(T n, T a, T b)
+	{
+		return	(a < b && (n >= a && n < b)) ||
+				(a > b && (n >= a || n < b));
+	}
+	/// @}
+} // namespace Chord
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "coremin.h"
+#include "hal/critical_section.h"
+#include "misc/time.h"
+
+#include "chord_fwd.h"
+#include "types.h"
+
+namespace Chord
+{
+	/**
+	 * @class RttTable chord/rtt_table.h
+	 *
+	 * Round-trip time estimates of remote
+	 * peers, indexed by peer address. Each
+	 * estimate keeps a smoothed RTT and its
+	 * mean deviation (Jacobson/Karels), from
+	 * which the retransmission timeout is
+	 * derived
+	 *
+	 * A request that times out backs off the
+	 * timeout of its recipient, until a new
+	 * sample is collected. When full, the
+	 * least recently sampled peer is evicted
+	 */
+	class RttTable
+	{
+	public:
+		/// A peer estimate
+		struct Estimate
+		{
+			/// Smoothed RTT (seconds)
+			float32 srtt;
+
+			/// RTT mean deviation (seconds)
+			float32 rttvar;
+
+			/// Current timeout (seconds)
+			float32 rto;
+
+			/// Time of last sample
+			float64 time;
+		};
+
+	protected:
+		/// Estimates by peer address
+		Map<uint64, Estimate> estimates;
+
+		/// Max number of peers
+		uint32 maxPeers;
+
+		/// Timeout of unknown peers (seconds)
+		float32 initialRto;
+
+		/// Timeout bounds (seconds)
+		/// @{
+		float32 minRto;
+		float32 maxRto;
+		/// @}
+
+		/// Guards estimates
+		RWLock guard;
+
+	public:
+		/**
+		 * Default constructor
+		 *
+		 * @param [in] maxPeers max number of peers
+		 * @param [in] initialRto timeout of unknown peers (seconds)
+		 * @param [in] minRto,maxRto timeout bounds (seconds)
+		 */
+		RttTable(uint32 maxPeers = 1024U, float32 initialRto = 1.f, float32 minRto = 0.2f, float32 maxRto = 5.f);
+
+		/// Returns number of known peers
+		FORCE_INLINE uint32 getCount() const
+		{
+			return estimates.getCount();
+		}
+
+		/// Returns max timeout (seconds)
+		FORCE_INLINE float32 getMaxTimeout() const
+		{
+			return maxRto;
+		}
+
+		/**
+		 * Returns reply timeout of peer
+		 *
+		 * @param [in] addr peer address
+		 * @return timeout (seconds)
+		 */
+		float32 getTimeout(const Ipv4 & addr);
+
+		/**
+		 * Returns smoothed RTT of peer
+		 *
+		 * @param [in] addr peer address
+		 * @return smoothed RTT (seconds),
+		 * 	or 0 if never sampled
+		 */
+		float32 getRtt(const Ipv4 & addr);
+
+		/**
+		 * Returns an upper bound of the RTT
+		 * of peer, k deviations above the
+		 * smoothed RTT
+		 *
+		 * @param [in] addr peer address
+		 * @param [in] k number of deviations
+		 * @return RTT bound (seconds),
+		 * 	or 0 if never sampled
+		 */
+		float32 getRttBound(const Ipv4 & addr, float32 k);
+
+		/**
+		 * Add a RTT sample of peer
+		 *
+		 * @param [in] addr peer address
+		 * @param [in] rtt measured round-trip time (seconds)
+		 */
+		void update(const Ipv4 & addr, float32 rtt);
+
+		/**
+		 * Double timeout of peer, after
+		 * a request has timed out
+		 *
+		 * @param [in] addr peer address
+		 */
+		void backoff(const Ipv4 & addr);
+
+	protected:
+		/// Returns map key of address
+		static FORCE_INLINE uint64 getKey(const Ipv4 & addr)
+		{
+			return ((uint64)addr.host << 16) | addr.port;
+		}
+
+		/// Evict least recently sampled peer
+		void evict();
+	};
+} // namespace Chord
@@ -0,0 +1,376 @@
+#pragma once
+
+#include "coremin.h"
+#include "hal/critical_section.h"
+
+#include "chord_fwd.h"
+
+namespace Chord
+{
+	/**
+	 * @class SegmentLog chord/segment_log.h
+	 *
+	 * An append-only log of key-value records,
+	 * split in fixed-size segment files that are
+	 * mapped in memory. Values are read straight
+	 * from the mapping. When a segment is full
+	 * a footer with the location, size and
+	 * checksum of all its records is written at
+	 * its end, so that on startup the index is
+	 * rebuilt from footers without reading the
+	 * records. Only the active segment, and
+	 * segments whose footer is damaged, are
+	 * scanned
+	 *
+	 * Records are written to the mapping and
+	 * synced to disk in batches by @ref flush.
+	 * Each append is counted, so that writers
+	 * can tell when their batch is synced
+	 */
+	class SegmentLog
+	{
+	public:
+		/// Size of a segment file (bytes)
+		enum : uint32 { SEGMENT_SIZE = 8U << 20 };
+
+		/// Max number of segments
+		enum : uint32 { MAX_SEGMENTS = 1024 };
+
+		/// Size of a removed record
+		enum : uint32 { TOMBSTONE = 0xffffffff };
+
+		/// Invalid segment index
+		enum : uint32 { NONE = 0xffffffff };
+
+	protected:
+		/// Footer magic number
+		enum : uint32 { MAGIC = 0x43484c48 };
+
+		/// Record header, followed by
+		/// value padded to 8 bytes
+		struct RecordHeader
+		{
+			/// Checksum of key, size and value
+			uint32 checksum;
+
+			/// Record key
+			uint32 key;
+
+			/// Size of value (bytes), or
+			/// tombstone if removed
+			uint32 size;
+
+			/// Padding
+			uint32 _pad;
+		};
+
+		/// Footer entry, one per record
+		struct FooterEntry
+		{
+			/// Record key
+			uint32 key;
+
+			/// Record offset (bytes)
+			uint32 offset;
+
+			/// Size of value (bytes),
+			/// or tombstone
+			uint32 size;
+
+			/// Checksum of value
+			uint32 checksum;
+		};
+
+		/// Segment trailer, last bytes of
+		/// a sealed segment
+		struct Trailer
+		{
+			/// Magic number
+			uint32 magic;
+
+			/// Number of footer entries
+			uint32 numEntries;
+
+			/// Offset of footer (bytes)
+			uint32 footerOffset;
+
+			/// Checksum of footer entries
+			/// and other fields
+			uint32 checksum;
+		};
+
+		/// A mapped segment
+		struct Segment
+		{
+			/// Sequence number, gives
+			/// replay order
+			uint32 seq;
+
+			/// Segment file
+			int32 fd;
+
+			/// Segment mapping
+			ubyte * data;
+
+			/// End of records (bytes)
+			uint32 writeOffset;
+
+			/// End of synced records (bytes)
+			uint32 syncOffset;
+
+			/// Bytes of records that
+			/// are no longer live
+			uint32 numDeadBytes;
+
+			/// Entries of active segment,
+			/// written on seal
+			FooterEntry * entries;
+
+			/// Number of records
+			uint32 numEntries;
+
+			/// Capacity of entries buffer
+			uint32 maxEntries;
+
+			/// True if footer was written
+			bool bSealed;
+
+			/// True if footer was synced
+			bool bSynced;
+		};
+
+		/// Directory of segment files
+		char path[256];
+
+		/// Segments, by index
+		Segment * segments[MAX_SEGMENTS];
+
+		/// Index of active segment
+		uint32 active;
+
+		/// Next sequence number
+		uint32 nextSeq;
+
+		/// Directory file, synced when
+		/// segments are added
+		int32 dirFd;
+
+		/// Number of records appended
+		Atomic<uint64> numAppended;
+
+		/// Number of records appended
+		/// as of the last successful flush
+		Atomic<uint64> numSynced;
+
+		/// Guards segments
+		CriticalSection guard;
+
+	public:
+		/// Default constructor
+		SegmentLog();
+
+		/// Destructor, syncs and unmaps
+		/// all segments
+		~SegmentLog();
+
+		/**
+		 * Open log in directory, creates it
+		 * if it doesn't exist and maps all
+		 * its segments
+		 *
+		 * @param [in] path directory path
+		 * @return true if log was opened
+		 */
+		bool open(const char * path);
+
+		/**
+		 * Call callback on all the records
+		 * of the log, in log order
+		 *
+		 * @param [in] callback void(uint32 segment, uint32 key, const ubyte * value, uint32 size, uint32 checksum)
+		 */
+		template<typename CallbackT>
+		void replay(CallbackT && callback)
+		{
+			// Segments by sequence number
+			uint32 order[MAX_SEGMENTS];
+			uint32 numSegments = 0;
+
+			for (uint32 i = 0; i < MAX_SEGMENTS; ++i)
+			{
+				if (!segments[i]) continue;
+
+				uint32 j = numSegments++;
+				for (; j > 0 && segments[order[j - 1]]->seq > segments[i]->seq; --j) order[j] = order[j - 1];
+				order[j] = i;
+			}
+
+			for (uint32 i = 0; i < numSegments; ++i)
+			{
+				const uint32 segment = order[i];
+				forEachRecord(segment, [&](uint32 key, const ubyte * value, uint32 size, uint32 checksum) {
+
+					callback(segment, key, value, size, checksum);
+				});
+			}
+		}
+
+		/**
+		 * Append a record to the active
+		 * segment, not synced until flush
+		 *
+		 * @param [in] key record key
+		 * @param [in] data value buffer
+		 * @param [in] size size of value
+		 * 	(bytes) or tombstone
+		 * @param [in] checksum checksum of
+		 * 	value, stored in the footer
+		 * @param [out] segment segment of
+		 * 	record
+		 * @return mapped value or null
+		 */
+		ubyte * append(uint32 key, const void * data, uint32 size, uint32 checksum, uint32 & segment);
+
+		/**
+		 * Mark a record as no longer live
+		 *
+		 * @param [in] segment segment of record
+		 * @param [in] size size of value or tombstone
+		 */
+		void release(uint32 segment, uint32 size);
+
+		/**
+		 * Sync all records appended since
+		 * last flush with a single call
+		 * per segment
+		 *
+		 * @return number of bytes synced
+		 */
+		uint32 flush();
+
+		/// Returns number of records appended,
+		/// a write is synced once the synced
+		/// count reaches it
+		FORCE_INLINE uint64 getNumAppended() const
+		{
+			return numAppended.load();
+		}
+
+		/// Returns number of records appended
+		/// as of the last successful flush
+		FORCE_INLINE uint64 getNumSynced() const
+		{
+			return numSynced.load();
+		}
+
+		/**
+		 * Returns a sealed and synced segment
+		 * whose records are mostly dead, or
+		 * none
+		 */
+		uint32 getCompactionCandidate();
+
+		/**
+		 * Call callback on all the records
+		 * of a segment. Only the index is
+		 * read, values are not touched
+		 *
+		 * @param [in] segment segment index
+		 * @param [in] callback void(uint32 key, const ubyte * value, uint32 size, uint32 checksum)
+		 */
+		template<typename CallbackT>
+		void forEachRecord(uint32 segment, CallbackT && callback)
+		{
+			const Segment * seg = segments[segment];
+			const FooterEntry * entries = seg->entries;
+			uint32 numEntries = seg->numEntries;
+
+			if (seg->bSealed)
+			{
+				// Read footer of sealed segments
+				const Trailer & trailer = getTrailer(seg->data);
+				entries = reinterpret_cast<const FooterEntry*>(seg->data + trailer.footerOffset);
+				numEntries = trailer.numEntries;
+			}
+
+			for (uint32 i = 0; i < numEntries; ++i)
+			{
+				const FooterEntry & entry = entries[i];
+				callback(entry.key, seg->data + entry.offset + sizeof(RecordHeader), entry.size, entry.checksum);
+			}
+		}
+
+		/// Returns true if segment has
+		/// the lowest sequence number
+		bool isOldest(uint32 segment);
+
+		/// Returns checksum of buffer
+		static uint32 getChecksum(const void * data, uint32 size, uint32 hash = 2166136261U);
+
+		/**
+		 * Unmap segment and delete its
+		 * file, no record must be live
+		 *
+		 * @param [in] segment segment index
+		 */
+		void drop(uint32 segment);
+
+	protected:
+		/// Returns size of record of value
+		static FORCE_INLINE uint32 getRecordSize(uint32 size)
+		{
+			return sizeof(RecordHeader) + (size == TOMBSTONE ? 0 : (size + 7) & ~7U);
+		}
+
+		/// Returns trailer of segment mapping
+		static FORCE_INLINE Trailer & getTrailer(ubyte * data)
+		{
+			return *reinterpret_cast<Trailer*>(data + SEGMENT_SIZE - sizeof(Trailer));
+		}
+
+		/// Returns checksum of record
+		static uint32 getChecksum(const RecordHeader & header);
+
+		/// Returns checksum of footer
+		/// entries and trailer fields
+		static uint32 getChecksum(const Trailer & trailer, const FooterEntry * entries);
+
+		/**
+		 * Check that footer of segment is
+		 * intact and that its entries point
+		 * to records before the footer
+		 *
+		 * @param [in] segment segment index
+		 * @return true if footer is valid
+		 */
+		bool checkFooter(uint32 segment);
+
+		/**
+		 * Map segment file, creates it
+		 * if doesn't exist
+		 *
+		 * @param [in] seq sequence number
+		 * @return segment index or none
+		 */
+		uint32 mapSegment(uint32 seq);
+
+		/**
+		 * Scan the records of an unsealed
+		 * segment, stops at the first
+		 * invalid record
+		 *
+		 * @param [in] segment segment index
+		 */
+		void scan(uint32 segment);
+
+		/// Add entry of record to segment
+		void addEntry(Segment * seg, uint32 key, uint32 offset, uint32 size, uint32 checksum);
+
+		/// Write footer of segment
+		void seal(uint32 segment);
+
+		/// Add a new active segment,
+		/// returns false on failure
+		bool rotate();
+	};
+} // namespace Chord
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "hal/runnable.h"
+
+#include "net/event_loop.h"
+#include "chord_fwd.h"
+
+namespace Chord
+{
+	/**
+	 * @class StoreTask chord/store_task.h
+	 * 
+	 * Syncs and compacts the persistent key
+	 * stores of all the virtual nodes of a
+	 * host in a separate thread. Writes are
+	 * synced in batches, and replied to once
+	 * their batch is synced
+	 *
+	 * Unlike maintenance, it doesn't run on
+	 * the receive task loop: syncs block on
+	 * the disk and would stall the socket
+	 */
+	class StoreTask : public Runnable
+	{
+	protected:
+		/// Group commit period (seconds)
+		static constexpr float32 FLUSH_PERIOD = 0.01f;
+
+		/// Host that owns this task
+		VirtualHost * host;
+
+		/// Event loop, drives store timers
+		EventLoop loop;
+
+		/// Flush timer, only armed while
+		/// writes are pending
+		int32 flushTimer;
+
+		/// True if flush timer is armed
+		Atomic<bool> bFlushing;
+
+	public:
+		/// Default constructor
+		StoreTask(VirtualHost * _host);
+
+		//////////////////////////////////////////////////
+		// Runnable interface
+		//////////////////////////////////////////////////
+		
+		/// @copydoc Runnable::init
+		virtual bool init() override;
+
+		/// @copydoc Runnable::run
+		virtual int32 run() override;
+
+		/// @copydoc Runnable::stop
+		virtual void stop() override;
+
+	protected:
+		/// Arm flush timer, can be called
+		/// from any thread
+		void armFlushes();
+
+		/// Returns true if any node has
+		/// pending writes
+		bool hasPendingWrites() const;
+	};
+} // namespace Chord
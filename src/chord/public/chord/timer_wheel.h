@@ -0,0 +1,214 @@
+#pragma once
+
+#include "coremin.h"
+#include "hal/critical_section.h"
+
+namespace Chord
+{
+	/**
+	 * @class TimerWheel chord/timer_wheel.h
+	 *
+	 * A hierarchical timing wheel. Each timer
+	 * has a small index chosen by the owner
+	 * (e.g. the slot of a pending request) and
+	 * carries a user key that is returned when
+	 * it expires. Arming and cancelling a timer
+	 * are O(1); advancing the wheel only touches
+	 * the timers that expire (plus an amortized
+	 * cascade from the upper levels)
+	 *
+	 * Timers are armed and cancelled through a
+	 * lock-free inbox, from any thread; the
+	 * wheel itself is owned by the thread that
+	 * calls @ref advance(). Operations on the
+	 * same timer are applied in inbox order
+	 */
+	class TimerWheel
+	{
+	public:
+		/// Wheel geometry
+		enum : uint32
+		{
+			NUM_LEVELS	= 4,
+			LEVEL_BITS	= 6,
+			NUM_SLOTS	= 1U << LEVEL_BITS,
+			SLOT_MASK	= NUM_SLOTS - 1
+		};
+
+	protected:
+		/// Special indices
+		enum : uint32
+		{
+			NIL		= 0xffffffff,
+			EXPIRED	= NUM_LEVELS * NUM_SLOTS,
+			FREE	= EXPIRED + 1
+		};
+
+		/// Deadline of a cancel in the inbox,
+		/// armed timers expire at tick 1 or later
+		enum : uint64 { CANCEL = 0ULL };
+
+		/// A timer entry
+		struct Entry
+		{
+			/// Next and previous entry in bucket
+			uint32 next, prev;
+
+			/// Bucket that holds this entry
+			uint32 bucket;
+
+			/// Expiration tick
+			uint64 deadline;
+
+			/// User key
+			uint64 key;
+		};
+
+		/// A timer operation waiting in the inbox
+		struct Arrival
+		{
+			/// Cell sequence number
+			Atomic<uint64> sequence;
+
+			/// Timer index
+			uint32 timer;
+
+			/// Expiration tick, or cancel
+			uint64 deadline;
+
+			/// User key
+			uint64 key;
+		};
+
+		/// Length of a tick (seconds)
+		float32 resolution;
+
+		/// Time of tick zero
+		float64 startTime;
+
+		/// Last processed tick
+		uint64 currTick;
+
+		/// Entries buffer, by timer index. It is
+		/// allocated upfront and entries are
+		/// initialized on first use, so that
+		/// untouched memory is never committed
+		Entry * entries;
+
+		/// Number of initialized entries
+		uint32 numEntries;
+
+		/// Max number of timers
+		uint32 maxEntries;
+
+		/// Buckets heads, last one holds expired entries
+		uint32 buckets[NUM_LEVELS * NUM_SLOTS + 1];
+
+		/// Number of timers in the wheel
+		uint64 count;
+
+		/// Inbox ring buffer
+		Arrival * inbox;
+
+		/// Inbox size - 1, size is a power of 2
+		uint64 inboxMask;
+
+		/// Inbox read position (consumer only)
+		uint64 inboxHead;
+
+		/// Inbox write position
+		Atomic<uint64> inboxTail;
+
+		/// Wheel guard, only contended if inbox is full
+		CriticalSection guard;
+
+	public:
+		/**
+		 * Default constructor
+		 *
+		 * @param [in] resolution length of a tick (seconds)
+		 * @param [in] maxTimers max number of timers,
+		 * 	timer indices must be lower
+		 * @param [in] inboxSize max number of operations
+		 * 	waiting in the inbox
+		 */
+		TimerWheel(float32 resolution = 0.05f, uint32 maxTimers = 1024U, uint32 inboxSize = 4096U);
+
+		/// Destructor
+		~TimerWheel();
+
+		/// Returns length of a tick (seconds)
+		FORCE_INLINE float32 getResolution() const
+		{
+			return resolution;
+		}
+
+		/// Returns number of timers in the wheel
+		FORCE_INLINE uint64 getCount() const
+		{
+			return count;
+		}
+
+		/**
+		 * Arm a timer, can be called from any
+		 * thread. A timer that is still armed
+		 * is replaced
+		 *
+		 * @param [in] timer timer index
+		 * @param [in] key user key
+		 * @param [in] timeout timer timeout (seconds)
+		 */
+		void arm(uint32 timer, uint64 key, float32 timeout);
+
+		/**
+		 * Cancel a timer, can be called from any
+		 * thread. It also cancels expired timers
+		 * not yet popped. Nothing happens if the
+		 * timer was re-armed with another key
+		 *
+		 * @param [in] timer timer index
+		 * @param [in] key user key
+		 */
+		void cancel(uint32 timer, uint64 key);
+
+		/**
+		 * Move wheel forward to current time
+		 * and collect expired timers
+		 */
+		void advance();
+
+		/**
+		 * Pop an expired timer
+		 *
+		 * @param [out] key expired timer key
+		 * @return false if no timer expired
+		 */
+		bool popExpired(uint64 & key);
+
+	protected:
+		/// Returns tick of the given time
+		FORCE_INLINE uint64 getTick(float64 time) const
+		{
+			return time > startTime ? (uint64)((time - startTime) / resolution) : 0ULL;
+		}
+
+		/// Push operation to the inbox, or apply
+		/// it directly if the inbox is full
+		void push(uint32 timer, uint64 key, uint64 deadline);
+
+		/// Apply operation, called with wheel locked
+		void apply(uint32 timer, uint64 key, uint64 deadline);
+
+		/// Apply operations in the inbox
+		void drain();
+
+		/// Place entry in the right bucket
+		void schedule(uint32 i);
+
+		/// Link entry in bucket
+		void link(uint32 i, uint32 bucket);
+
+		/// Unlink entry from its bucket
+		void unlink(uint32 i);
+	};
+} // namespace Chord
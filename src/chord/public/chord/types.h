@@ -1,6 +1,7 @@
 #pragma once
 
 #include "chord_fwd.h"
+#include "net_coord.h"
 
 namespace Chord
 {
@@ -18,12 +19,29 @@ namespace Chord
 		/// Node address
 		Ipv4 addr;
 
+		/// Network coordinate of node,
+		/// as last advertised
+		NetCoord coord;
+
+	public:
+		/// Size of a buffer that fits the info string
+		enum : uint32 { INFO_STRING_SIZE = 48 };
+
 	public:
 		/// Get string with info
 		FORCE_INLINE String getInfoString() const
 		{
-			char info[256]; snprintf(info, 256, "#%08x @ %s", id, *getIpString(addr));
-			return String(info);
+			char info[INFO_STRING_SIZE];
+			return String(getInfoString(info, sizeof(info)));
+		}
+
+		/// Write info string to buffer,
+		/// doesn't allocate any memory
+		FORCE_INLINE const char * getInfoString(char * info, uint32 len) const
+		{
+			char ip[INFO_STRING_SIZE];
+			snprintf(info, len, "#%08x @ %s", id, getIpString(addr, ip, sizeof(ip)));
+			return info;
 		}
 	};
 } // namespace Chord
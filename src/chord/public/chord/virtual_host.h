@@ -0,0 +1,139 @@
+#pragma once
+
+#include "coremin.h"
+
+#include "chord_fwd.h"
+#include "local_node.h"
+
+namespace Chord
+{
+	/**
+	 * @class VirtualHost chord/virtual_host.h
+	 * 
+	 * Hosts one or more virtual nodes, each
+	 * with its own id and routing state. All
+	 * nodes share the same socket and are
+	 * driven by the same receive task.
+	 * Incoming requests are delivered
+	 * to the node whose id is the request
+	 * target, or to the first node if no
+	 * node matches (e.g. a join bootstrap).
+	 * Replies must match a node
+	 */
+	class VirtualHost
+	{
+		friend ReceiveTask;
+		friend StoreTask;
+
+	public:
+		/// Max number of virtual nodes
+		enum : uint32 { MAX_NODES = 64 };
+
+	protected:
+		/// Socket shared by all nodes
+		SocketDgram socket;
+
+		/// Virtual nodes
+		LocalNode * nodes[MAX_NODES];
+
+		/// Number of virtual nodes
+		uint32 numNodes;
+
+	public:
+		/**
+		 * Bind socket and create nodes
+		 * 
+		 * @param [in] numNodes number of virtual nodes
+		 * @param [in] port port to bind (host byte
+		 * 	order), 0 for any. A fixed port keeps
+		 * 	node ids across restarts
+		 * @param [in] maxRequests max number of
+		 * 	pending requests of each node
+		 */
+		VirtualHost(uint32 numNodes = 1U, uint16 port = 0U, uint32 maxRequests = LocalNode::DEFAULT_MAX_REQUESTS);
+
+		/// Destructor
+		~VirtualHost();
+
+		/// Returns whether host socket is bound
+		FORCE_INLINE bool isInit() const
+		{
+			return socket.isInit() && numNodes > 0;
+		}
+
+		/// Returns number of virtual nodes
+		FORCE_INLINE uint32 getNumNodes() const
+		{
+			return numNodes;
+		}
+
+		/// Returns i-th virtual node
+		FORCE_INLINE LocalNode & getNode(uint32 i) const
+		{
+			return *nodes[i];
+		}
+
+		/**
+		 * Open a persistent store for each
+		 * node, in a subdirectory of path
+		 * 
+		 * @param [in] path data directory
+		 * @return true if all stores were opened
+		 */
+		bool openStores(const char * path);
+
+		/**
+		 * Create a new ring, the other nodes
+		 * join through the first one. Replies
+		 * are handled by the receive task,
+		 * which must be already running
+		 */
+		void create();
+
+		/**
+		 * Join chord ring with all nodes. The
+		 * first node joins through peer, the
+		 * others through the first node
+		 * 
+		 * @param [in] peer address of a known peer
+		 * @return true if first node joined
+		 */
+		bool join(const Ipv4 & peer);
+
+		/**
+		 * Leave chord ring with all nodes. Nodes
+		 * forget each other first, so that keys
+		 * and neighbours are handed off to
+		 * remote nodes. Blocks until all keys
+		 * are acked or given up
+		 */
+		void leave();
+
+	protected:
+		/**
+		 * Find node by id, few nodes so
+		 * linear search is fine
+		 * 
+		 * @param [in] id node id
+		 * @return node or null
+		 */
+		LocalNode * findNode(uint32 id) const;
+
+		/**
+		 * Find node by the id it had before
+		 * its last move
+		 * 
+		 * @param [in] id previous node id
+		 * @return node or null
+		 */
+		LocalNode * findMovedNode(uint32 id) const;
+
+		/**
+		 * Deliver incoming request to
+		 * its target node
+		 * 
+		 * @param [in] req incoming request
+		 */
+		void handleRequest(const Request & req);
+	};
+} // namespace Chord
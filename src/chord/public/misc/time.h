@@ -3,11 +3,17 @@
 #include "core_types.h"
 
 //////////////////////////////////////////////////
-// Time global variables
+// Time global functions
 //////////////////////////////////////////////////
 
-extern uint64 currTick;
-extern uint64 prevTick;
+/**
+ * Returns time measured by a monotonic
+ * wall clock, unaffected by process load
+ * and system time changes
+ * 
+ * @return time in seconds
+ */
+float64 getTime();
 
 /**
  * @struct Timer misc/timer.h
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "coremin.h"
+#include "templates/reference.h"
+
+namespace Net
+{
+	/**
+	 * @class EventLoop net/event_loop.h
+	 *
+	 * An epoll event loop that multiplexes
+	 * readable file descriptors, timerfd
+	 * timers and a wakeup eventfd. The calling
+	 * thread sleeps until something happens
+	 */
+	class EventLoop
+	{
+	public:
+		/// Event handler type
+		using HandlerT = Function<void()>;
+
+	protected:
+		/// An event source registered in the loop
+		struct Source
+		{
+			/// Source file descriptor
+			int32 fd;
+
+			/// True if it is a timer
+			bool bTimer;
+
+			/// Event handler
+			HandlerT handler;
+		};
+
+		/// Epoll file descriptor
+		int32 epollfd;
+
+		/// Wakeup event file descriptor
+		int32 wakefd;
+
+		/// Registered sources
+		LinkedList<Source*> sources;
+
+		/// Set when loop is stopped
+		volatile bool bStopped;
+
+	public:
+		/// Default constructor
+		EventLoop();
+
+		/// Destructor, closes all descriptors
+		~EventLoop();
+
+		/// Returns true if loop is initialized
+		FORCE_INLINE bool isInit() const
+		{
+			return epollfd != -1 && wakefd != -1;
+		}
+
+		/// Initialize loop
+		bool init();
+
+		/**
+		 * Register a file descriptor, handler
+		 * is called whenever fd is readable
+		 *
+		 * @param [in] fd file descriptor
+		 * @param [in] handler event handler
+		 * @return operation status
+		 */
+		bool addReader(int32 fd, HandlerT && handler);
+
+		/**
+		 * Register a periodic timer, driven by
+		 * the monotonic (wall) clock
+		 *
+		 * @param [in] interval timer interval (seconds)
+		 * @param [in] handler event handler
+		 * @return timer handle or -1
+		 */
+		int32 addTimer(float32 interval, HandlerT && handler);
+
+		/**
+		 * Re-arm timer with a new interval. A
+		 * zero interval disarms the timer
+		 *
+		 * @param [in] timer timer handle
+		 * @param [in] interval new interval (seconds)
+		 * @return operation status
+		 */
+		bool setTimer(int32 timer, float32 interval);
+
+		/**
+		 * Wait for events and dispatch them
+		 *
+		 * @param [in] timeout max wait time (ms), -1 waits forever
+		 * @return false if loop was stopped
+		 */
+		bool runOnce(int32 timeout = -1);
+
+		/**
+		 * Run until @ref stop() is called
+		 *
+		 * @return exit code
+		 */
+		int32 run();
+
+		/// Wake up loop thread
+		void wakeup();
+
+		/// Stop loop, can be called from any thread
+		void stop();
+	};
+} // namespace Net
@@ -38,6 +38,12 @@ namespace Net
 			return sockfd != -1;
 		}
 
+		/// Returns socket file descriptor
+		FORCE_INLINE int32 getFileDescriptor() const
+		{
+			return sockfd;
+		}
+
 		/// Get socket binding address
 		/// @{
 		template<typename IpType = Ipv4>
@@ -106,14 +112,15 @@ namespace Net
 		 * @param [in] len buffer length in bytes
 		 * @param [out] val out value
 		 * @param [out] sender sender ipv4 address
+		 * @param [in] flags recvfrom flags
 		 * @return num bytes read or status
 		 * @{
 		 */
 		template<typename IpType = Ipv4>
-		FORCE_INLINE int32 read(void * buffer, sizet len, IpType & sender)
+		FORCE_INLINE int32 read(void * buffer, sizet len, IpType & sender, int32 flags = 0)
 		{
 			socklen_t addrLen = sizeof(sender.__addr);
-			return ::recvfrom(sockfd, buffer, len, 0, &sender.__addr, &addrLen);
+			return ::recvfrom(sockfd, buffer, len, flags, &sender.__addr, &addrLen);
 		}
 		FORCE_INLINE int32 read(void * buffer, sizet len)
 		{
@@ -134,6 +141,31 @@ namespace Net
 		}
 		/// @}
 
+		/**
+		 * Like @ref read() but returns
+		 * immediately if no data is available
+		 * 
+		 * @param [out] buffer buffer allocated for data
+		 * @param [in] len buffer length in bytes
+		 * @param [out] val out value
+		 * @param [out] sender sender ipv4 address
+		 * @return num bytes read or status (or
+		 * 	true if value was read)
+		 * @{
+		 */
+		template<typename IpType = Ipv4>
+		FORCE_INLINE int32 tryRead(void * buffer, sizet len, IpType & sender)
+		{
+			return read(buffer, len, sender, MSG_DONTWAIT);
+		}
+
+		template<typename T, typename IpType = Ipv4>
+		FORCE_INLINE bool tryRead(T & val, IpType & sender)
+		{
+			return read((void*)&val, (sizet)sizeof(T), sender, MSG_DONTWAIT) == sizeof(T);
+		}
+		/// @}
+
 		/**
 		 * Write data
 		 * 
@@ -113,6 +113,18 @@ namespace Net
 	template<typename IpType = Ipv4>
 	String getIpString(const IpType & addr);
 
+	/**
+	 * Write ip string to buffer, doesn't
+	 * allocate any memory
+	 * 
+	 * @param [in] addr ip address
+	 * @param [out] str output buffer
+	 * @param [in] len buffer length
+	 * @return output buffer
+	 */
+	template<typename IpType = Ipv4>
+	const char * getIpString(const IpType & addr, char * str, uint32 len);
+
 	/**
 	 * Get address of first available interface
 	 * 
@@ -0,0 +1,214 @@
+#include "coremin.h"
+#include "hal/threading.h"
+#include "misc/command_line.h"
+#include "misc/time.h"
+#include "chord/chord.h"
+
+#include <new>
+#include <stdlib.h>
+#include <unistd.h>
+
+/// The global allocator used by default
+Malloc * gMalloc = nullptr;
+
+/// Thread manager
+ThreadManager * gThreadManager = nullptr;
+
+/// Global argument parser
+CommandLine * gCommandLine = nullptr;
+
+/// Number of allocations made since the
+/// counter was last reset, by any thread
+static Atomic<uint64> numAllocs{0ULL};
+
+/**
+ * Forwards to the base allocator and
+ * counts every allocation
+ */
+class CountingMalloc : public Malloc
+{
+protected:
+	/// Allocator that does the work
+	Malloc * base;
+
+public:
+	/// Default constructor
+	CountingMalloc(Malloc * _base) : base{_base} {}
+
+	virtual void * malloc(uintP n, uint32 alignment = DEFAULT_ALIGNMENT) override
+	{
+		++numAllocs;
+		return base->malloc(n, alignment);
+	}
+
+	virtual void * realloc(void * original, uintP n, uint32 alignment = DEFAULT_ALIGNMENT) override
+	{
+		++numAllocs;
+		return base->realloc(original, n, alignment);
+	}
+
+	virtual void free(void * original) override
+	{
+		base->free(original);
+	}
+
+	virtual bool getAllocSize(void * original, uintP & n) override
+	{
+		return base->getAllocSize(original, n);
+	}
+};
+
+/// Global operator new is counted as
+/// well, it backs std::function
+/// @{
+void * operator new(size_t n)
+{
+	++numAllocs;
+	if (void * p = ::malloc(n ? n : 1)) return p;
+	throw std::bad_alloc{};
+}
+
+void * operator new[](size_t n)
+{
+	return operator new(n);
+}
+
+void operator delete(void * p) noexcept
+{
+	::free(p);
+}
+
+void operator delete[](void * p) noexcept
+{
+	::free(p);
+}
+
+void operator delete(void * p, size_t) noexcept
+{
+	::free(p);
+}
+
+void operator delete[](void * p, size_t) noexcept
+{
+	::free(p);
+}
+/// @}
+
+namespace Chord
+{
+	/**
+	 * Processes incoming messages on the
+	 * calling thread, without running
+	 * node maintenance
+	 */
+	class PumpTask : public ReceiveTask
+	{
+	public:
+		/// Inherit constructor
+		using ReceiveTask::ReceiveTask;
+
+		/// Process all pending messages
+		FORCE_INLINE void pump()
+		{
+			receive();
+		}
+	};
+} // namespace Chord
+
+/// Lookups of each round, spread over the ring
+static constexpr uint32 numKeys = 64;
+
+/// Rounds of lookups that warm up pools
+static constexpr uint32 numWarmRounds = 2;
+
+/**
+ * Lookup keys spread over the ring, one at a
+ * time, processing replies on this thread
+ *
+ * @return false if a lookup failed
+ */
+static bool runRound(Chord::LocalNode & node, Chord::PumpTask & pump)
+{
+	// Let cached ranges expire, so that
+	// lookups go through the network
+	usleep(2100000);
+
+	for (uint32 i = 0; i < numKeys; ++i)
+	{
+		const uint32 key = i * (0xffffffffU / numKeys) + 0x1234U;
+
+		auto out = node.lookup(key);
+
+		const float64 startTime = getTime();
+		while (!out.isReady() && getTime() - startTime < 2.0) pump.pump();
+
+		// Failed lookups return the wildcard address
+		if (!out.isReady() || (out.get().addr.host == Net::Ipv4::any.host && out.get().addr.port == Net::Ipv4::any.port))
+		{
+			printf("TEST: lookup of key 0x%08x failed\n", key);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int32 main(int32 argc, char ** argv)
+{
+	// Count allocations of the global allocator,
+	// before anything caches it
+	Memory::createGMalloc();
+	gMalloc = new CountingMalloc(gMalloc);
+	gThreadManager = new ThreadManager();
+	gCommandLine = new CommandLine(argc, argv);
+
+	// Form a ring of virtual nodes
+	// with maintenance running
+	Chord::VirtualHost host{8, 0};
+	if (!host.isInit()) return 1;
+
+	auto receiver = RunnableThread::create(new Chord::ReceiveTask(&host), "Receiver");
+	host.create();
+	usleep(6000000);
+
+	// Stop maintenance, only lookups run from now on
+	receiver->kill();
+
+	Chord::PumpTask pump{&host};
+	Chord::LocalNode & node = host.getNode(0);
+
+	struct Mode
+	{
+		const char * name;
+		Chord::LocalNode::LookupMode lookupMode;
+		float32 hedgeDelay;
+	};
+
+	const Mode modes[] = {
+		{"recursive", Chord::LocalNode::RECURSIVE, 0.f},
+		{"iterative", Chord::LocalNode::ITERATIVE, 0.f},
+		{"hedged", Chord::LocalNode::RECURSIVE, 0.001f}
+	};
+
+	bool bPassed = true;
+
+	for (const Mode & mode : modes)
+	{
+		node.setLookupMode(mode.lookupMode);
+		node.setHedgeDelay(mode.hedgeDelay);
+
+		for (uint32 i = 0; i < numWarmRounds; ++i)
+			if (!runRound(node, pump)) return 1;
+
+		numAllocs.store(0ULL);
+		if (!runRound(node, pump)) return 1;
+
+		const uint64 count = numAllocs.load();
+		printf("TEST: %u %s lookups made %llu allocations\n", numKeys, mode.name, (unsigned long long)count);
+
+		bPassed &= count == 0;
+	}
+
+	printf("TEST: %s\n", bPassed ? "passed" : "failed");
+	return bPassed ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#include "coremin.h"
+#include "hal/threading.h"
+#include "misc/command_line.h"
+#include "chord/chord.h"
+
+/// The global allocator used by default
+Malloc * gMalloc = nullptr;
+
+/// Thread manager
+ThreadManager * gThreadManager = nullptr;
+
+/// Global argument parser
+CommandLine * gCommandLine = nullptr;
+
+namespace Chord
+{
+	/**
+	 * Exposes the routing state of a node,
+	 * no receive task runs for it
+	 */
+	class RoutingNode : public LocalNode
+	{
+	public:
+		/// Inherit constructor
+		using LocalNode::LocalNode;
+
+		using LocalNode::learnPeer;
+		using LocalNode::getProximity;
+
+		/// Record an RTT sample to peer
+		FORCE_INLINE void measure(const NodeInfo & peer, float32 rtt)
+		{
+			rtts.update(peer.addr, rtt);
+		}
+
+		/// Set node coordinate
+		FORCE_INLINE void setCoord(const NetCoord & coord)
+		{
+			self.coord = coord;
+		}
+
+		/// Returns node id
+		FORCE_INLINE uint32 getId() const
+		{
+			return id;
+		}
+
+		/// Returns a peer at given offset
+		/// from node, on a fake port
+		FORCE_INLINE NodeInfo makePeer(uint32 offset) const
+		{
+			NodeInfo peer = self;
+			peer.id = id + offset;
+			peer.addr.setPort(40000 + (offset >> 24));
+
+			return peer;
+		}
+	};
+} // namespace Chord
+
+/// Report check result
+#define CHECK(cond) if (!(cond)) { printf("TEST: failed %s, line %d\n", #cond, __LINE__); bPassed = false; }
+
+/**
+ * Peers that precede the key of a finger
+ * must never be installed in it
+ */
+static bool testLearnPeer(Chord::RoutingNode & node)
+{
+	bool bPassed = true;
+
+	// Keep learned peers out of the successor range
+	node.setSuccessor(node.makePeer(1U));
+
+	// Precedes the key of all fingers past #19
+	const Chord::NodeInfo peer = node.makePeer((1U << 20) - 16U);
+	node.learnPeer(peer);
+
+	CHECK(node.getFinger(19).id == peer.id);
+	for (uint32 i = 20; i < 32; ++i)
+		CHECK(node.getFinger(i).id == node.getId());
+
+	// Succeeds the key of finger #24, and
+	// is closer than the unset finger
+	const Chord::NodeInfo next = node.makePeer((1U << 24) + 16U);
+	node.learnPeer(next);
+
+	for (uint32 i = 20; i < 25; ++i)
+		CHECK(node.getFinger(i).id == next.id);
+	for (uint32 i = 25; i < 32; ++i)
+		CHECK(node.getFinger(i).id == node.getId());
+
+	// Does not replace the closer finger
+	node.learnPeer(node.makePeer((1U << 25) + 16U));
+
+	for (uint32 i = 20; i < 25; ++i)
+		CHECK(node.getFinger(i).id == next.id);
+
+	printf("TEST: learn peer %s\n", bPassed ? "passed" : "failed");
+	return bPassed;
+}
+
+/**
+ * Peers with no RTT sample, whose coordinate
+ * or ours has not settled yet, must never
+ * rank ahead of a measured peer
+ */
+static bool testProximity(Chord::RoutingNode & node)
+{
+	bool bPassed = true;
+
+	const Chord::NodeInfo measured = node.makePeer(1U << 24);
+	node.measure(measured, 0.05f);
+
+	// Never probed, still at the origin
+	const Chord::NodeInfo unmeasured = node.makePeer(2U << 24);
+	CHECK(node.getProximity(unmeasured) > node.getProximity(measured));
+
+	// Peer coordinate settled, ours not yet
+	Chord::NodeInfo settled = node.makePeer(3U << 24);
+	settled.coord = Chord::NetCoord{{0.001f, 0.f}, 0.f, 0.1f};
+	CHECK(node.getProximity(settled) > node.getProximity(measured));
+
+	// Both settled, prediction is used
+	node.setCoord(Chord::NetCoord{{0.f, 0.f}, 0.f, 0.1f});
+	CHECK(node.getProximity(settled) < node.getProximity(measured));
+
+	printf("TEST: proximity %s\n", bPassed ? "passed" : "failed");
+	return bPassed;
+}
+
+int32 main(int32 argc, char ** argv)
+{
+	Memory::createGMalloc();
+	gThreadManager = new ThreadManager();
+	gCommandLine = new CommandLine(argc, argv);
+
+	Net::SocketDgram socket;
+	if (!socket.init() || !socket.bind()) return 1;
+
+	bool bPassed = true;
+
+	{
+		Chord::RoutingNode node{socket};
+		bPassed &= testLearnPeer(node);
+		bPassed &= testProximity(node);
+	}
+
+	printf("TEST: %s\n", bPassed ? "passed" : "failed");
+	return bPassed ? 0 : 1;
+}
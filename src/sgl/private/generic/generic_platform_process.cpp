@@ -1,6 +1,17 @@
 #include "generic/generic_platform_process.h"
 #include "hal/event.h"
 #include "hal/event_pthread.h"
+#include "hal/critical_section.h"
+
+/// Max number of released events kept for reuse
+#define MAX_POOLED_EVENTS 1024
+
+/// Pool of released events
+/// @{
+static Event * pooledEvents[MAX_POOLED_EVENTS];
+static uint32 numPooledEvents = 0;
+static CriticalSection eventsGuard;
+/// @}
 
 Event * GenericPlatformProcess::createEvent()
 {
@@ -21,12 +32,34 @@ Event * GenericPlatformProcess::createEvent()
 
 Event * GenericPlatformProcess::getEvent()
 {
-	/// @todo Create a thread pool to reuse existing events
+	{
+		ScopeLock _(&eventsGuard);
+
+		// Reuse a released event
+		if (numPooledEvents > 0)
+			return pooledEvents[--numPooledEvents];
+	}
+
 	return createEvent();
 }
 
 void GenericPlatformProcess::releaseEvent(Event * event)
 {
-	/// @todo For now, we just delete it
+	if (event == nullptr) return;
+
+	// Event must be untriggered when reused
+	event->reset();
+
+	{
+		ScopeLock _(&eventsGuard);
+
+		if (numPooledEvents < MAX_POOLED_EVENTS)
+		{
+			pooledEvents[numPooledEvents++] = event;
+			return;
+		}
+	}
+
+	// Pool is full
 	delete event;
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "hal/malloc_recycle.h"
+
+MallocRecycle::MallocRecycle(sizet _blockSize, uint64 _maxFreeBlocks, Malloc * _backup) :
+	blockSize(_blockSize > sizeof(void*) ? _blockSize : sizeof(void*)),
+	head(nullptr),
+	numFreeBlocks(0),
+	maxFreeBlocks(_maxFreeBlocks),
+	backup(_backup) {}
+
+MallocRecycle::~MallocRecycle()
+{
+	while (head)
+	{
+		void * next = *reinterpret_cast<void**>(head);
+		backup->free(head);
+		head = next;
+	}
+}
+
+void * MallocRecycle::malloc(sizet n, uint32 alignment)
+{
+	ASSERT(n <= blockSize, "Requested size exceeds block size");
+
+	{
+		ScopeLock _(&guard);
+
+		if (head)
+		{
+			// Pop first free block
+			void * block = head;
+			head = *reinterpret_cast<void**>(block);
+			--numFreeBlocks;
+
+			return block;
+		}
+	}
+
+	return backup->malloc(blockSize, alignment);
+}
+
+void * MallocRecycle::realloc(void * original, sizet n, uint32 alignment)
+{
+	if (original == nullptr) return malloc(n, alignment);
+
+	// Blocks cannot grow
+	return n <= blockSize ? original : nullptr;
+}
+
+void MallocRecycle::free(void * original)
+{
+	if (original == nullptr) return;
+
+	{
+		ScopeLock _(&guard);
+
+		if (numFreeBlocks < maxFreeBlocks)
+		{
+			// Push in front of free list
+			*reinterpret_cast<void**>(original) = head;
+			head = original;
+			++numFreeBlocks;
+
+			return;
+		}
+	}
+
+	backup->free(original);
+}
+
+bool MallocRecycle::getAllocSize(void * original, sizet & n)
+{
+	n = blockSize;
+	return true;
+}
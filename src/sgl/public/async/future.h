@@ -4,6 +4,7 @@
 #include "hal/event.h"
 #include "hal/critical_section.h"
 #include "hal/platform_process.h"
+#include "hal/malloc_recycle.h"
 #include "templates/atomic.h"
 #include "templates/function.h"
 #include "templates/reference.h"
@@ -19,12 +20,14 @@ public:
 	/// @brief Default constructor
 	FORCE_INLINE GenericFutureState() :
 		completionEvent(PlatformProcess::getEvent()),
-		bComplete(false) {}
+		bComplete(false),
+		bClaimed(false) {}
 
 	/// @brief Callback-constructor
 	FORCE_INLINE GenericFutureState(Function<void()> && _callback) :
 		completionEvent(PlatformProcess::getEvent()),
 		bComplete(false),
+		bClaimed(false),
 		callback(::move(_callback)) {}
 
 
@@ -69,11 +72,24 @@ public:
 		{
 			ScopeLock _(&mutex);
 			bComplete = false;
+			bClaimed = false;
 		}
 		completionEvent->reset();
 	}
 
 protected:
+	/**
+	 * @brief Claim the right to complete the future,
+	 * must be called before writing the result
+	 * 
+	 * @return @c true if no one claimed it before
+	 */
+	FORCE_INLINE bool claim()
+	{
+		bool expected = false;
+		return bClaimed.compareExchange(expected, true);
+	}
+
 	/// @brief Mark as complete and signal waiting threads
 	FORCE_INLINE void complete()
 	{
@@ -98,6 +114,9 @@ protected:
 
 	/// @brief Indicates if the result is available
 	Atomic<bool> bComplete;
+
+	/// @brief Indicates if a thread is completing the future
+	Atomic<bool> bClaimed;
 };
 
 /**
@@ -128,7 +147,8 @@ public:
 	/// @brief Set result and mark complete
 	FORCE_INLINE void setResult(const T & _result)
 	{
-		if (!isComplete())
+		// Only the first setter writes the result
+		if (claim())
 		{
 			result = _result;
 			complete();
@@ -153,14 +173,15 @@ protected:
 
 public:
 	/// @brief Returns true if result is ready and state is valid
-	FORCE_INLINE bool isReady() const { return state & state->isComplete(); }
+	FORCE_INLINE bool isReady() const { return state && state->isComplete(); }
 
 	/// @brief Waits for the result to be ready
 	FORCE_INLINE void wait(uint32 waitTime = ((uint32)-1)) const { return state && state->wait(waitTime); }
 
 protected:
 	/// @brief Default-cosntructor, internal use only
-	FORCE_INLINE BasePromise() : state(std::make_shared<FutureState<T>>()) {}
+	/// State blocks are recycled
+	FORCE_INLINE BasePromise() : state(std::allocate_shared<FutureState<T>>(RecycleAllocator<FutureState<T>>())) {}
 
 	/// @brief State-constructor, internal use only
 	FORCE_INLINE BasePromise(const StateRef & _state) : state(_state) {}
@@ -177,9 +198,16 @@ public:
 	/// @brief Inherit constructors
 	using BasePromise<T>::BasePromise;
 
+	/// @brief Inherit state queries
+	using BasePromise<T>::isReady;
+
 	/// @brief Default-constuctor
 	Promise() = default;
 
+	/// @brief Null-constructor, promise has no
+	/// state and can only be assigned
+	explicit FORCE_INLINE Promise(std::nullptr_t) : BasePromise<T>(nullptr) {}
+
 	/// @brief Returns future result (waits for the result to be available)
 	FORCE_INLINE const T & get() const { return this->state->getResult(); }
 
@@ -263,9 +263,13 @@ public:
 		
 		BinaryNode * succ = this;
 
-		// Get actual successor
+		// Get actual successor, and replace
+		// our data with its own
 		if (left != nullptr && right != nullptr)
+		{
+			data.~T();
 			moveOrCopy(data, (succ = right->getMin())->data);
+		}
 		
 		// Remove left or right child of successor
 		BinaryNode * repl = nullptr;
@@ -787,6 +791,13 @@ protected:
 		return new (reinterpret_cast<NodeRef>(allocator->malloc(sizeof(Node)))) Node(data);
 	}
 
+	/// Destroy node and dealloc it using the class allocator
+	FORCE_INLINE void destroyNode(NodeRef node)
+	{
+		node->~Node();
+		allocator->free(node);
+	}
+
 	/// Recursively replicate structure of another tree
 	template<typename U>
 	void replicateStructure(NodeRef replica, BinaryNodeRef<U> original)
@@ -1004,7 +1015,7 @@ public:
 				root = root->getRoot();
 			}
 			else
-				allocator->free(node);
+				destroyNode(node);
 
 			return actualNode->data;
 		}
@@ -1046,7 +1057,7 @@ public:
 					root = root->getRoot();
 				
 				// Dealloc evicted node
-				allocator->free(evicted);
+				destroyNode(evicted);
 			}
 		}
 	}
@@ -1064,7 +1075,7 @@ public:
 				root = root->getRoot();
 
 			// Dealloc evicted node
-			allocator->free(evicted);
+			destroyNode(evicted);
 		}
 	}
 	void remove(TreeIterator it)
@@ -1081,7 +1092,7 @@ public:
 				root = root->getRoot();
 
 			// Dealloc evicted node
-			allocator->free(evicted);
+			destroyNode(evicted);
 		}
 	}
 	/// @}
@@ -1100,7 +1111,7 @@ protected:
 				right	= node->right;
 			
 			// Dealloc node
-			allocator->free(node);
+			destroyNode(node);
 
 			// Depth first
 			empty(left), empty(right);
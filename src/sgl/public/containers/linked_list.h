@@ -112,10 +112,12 @@ public:
 		FORCE_INLINE LinkedListIterator<U> & operator++()
 		{
 			curr = curr->next;
+			return *this;
 		}
 		FORCE_INLINE LinkedListIterator<U> & operator--()
 		{
 			curr = curr->prev;
+			return *this;
 		}
 
 		FORCE_INLINE bool operator==(const LinkedListIterator & iter) const { return curr == iter.curr; }
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "core_types.h"
+#include "platform_memory.h"
+#include "critical_section.h"
+
+/**
+ * @class MallocRecycle hal/malloc_recycle.h
+ *
+ * A thread-safe allocator of fixed size
+ * blocks. Freed blocks are kept in a free
+ * list embedded in the blocks themselves
+ * and handed out again, so that once warm
+ * no memory is requested to the backup
+ * allocator.
+ *
+ * Only up to a max number of free blocks
+ * are kept, exceeding blocks are returned
+ * to the backup allocator. Requests larger
+ * than the block size are not supported.
+ */
+class MallocRecycle : public Malloc
+{
+protected:
+	/// Size of a single block in Bytes
+	sizet blockSize;
+
+	/// Head of free list
+	void * head;
+
+	/// Number of free blocks
+	uint64 numFreeBlocks;
+
+	/// Max number of free blocks kept
+	uint64 maxFreeBlocks;
+
+	/// Allocator used to create new blocks
+	Malloc * backup;
+
+	/// Guards free list
+	CriticalSection guard;
+
+public:
+	/// Default constructor
+	MallocRecycle(sizet _blockSize = 64/* Bytes */, uint64 _maxFreeBlocks = 4096, Malloc * _backup = gMalloc);
+
+	/// Destructor, releases free blocks
+	~MallocRecycle();
+
+	/// Returns num of free blocks
+	FORCE_INLINE uint64 getNumFreeBlock() const { return numFreeBlocks; }
+
+	//////////////////////////////////////////////////
+	// Malloc interface
+	//////////////////////////////////////////////////
+
+	/// @copydoc Malloc::malloc()
+	virtual void * malloc(sizet n, uint32 alignment = DEFAULT_ALIGNMENT) override;
+
+	/// @copydoc Malloc::realloc()
+	virtual void * realloc(void * original, sizet n, uint32 alignment = DEFAULT_ALIGNMENT) override;
+
+	/// @copydoc Malloc::free()
+	virtual void free(void * original) override;
+
+	/// @copydoc Malloc::getAllocSize()
+	virtual bool getAllocSize(void * original, sizet & n) override;
+};
+
+/**
+ * @class RecycleAllocator hal/malloc_recycle.h
+ *
+ * Stl allocator backed by a @ref MallocRecycle
+ * shared by all allocators of the same type.
+ * Can be used with @c std::allocate_shared
+ * to recycle the control block and the object
+ * in a single block.
+ */
+template<typename T>
+struct RecycleAllocator
+{
+	using value_type = T;
+
+	/// Default constructor
+	RecycleAllocator() = default;
+
+	/// Rebind constructor
+	template<typename U>
+	FORCE_INLINE RecycleAllocator(const RecycleAllocator<U>&) {}
+
+	/// Allocate n objects, only single
+	/// objects are recycled
+	FORCE_INLINE T * allocate(sizet n)
+	{
+		return reinterpret_cast<T*>(n == 1 ? getMalloc()->malloc(sizeof(T), alignof(T)) : gMalloc->malloc(n * sizeof(T), alignof(T)));
+	}
+
+	/// Deallocate n objects
+	FORCE_INLINE void deallocate(T * original, sizet n)
+	{
+		n == 1 ? getMalloc()->free(original) : gMalloc->free(original);
+	}
+
+	/// All allocators share the same blocks
+	/// @{
+	template<typename U>
+	FORCE_INLINE bool operator==(const RecycleAllocator<U>&) const { return true; }
+	template<typename U>
+	FORCE_INLINE bool operator!=(const RecycleAllocator<U>&) const { return false; }
+	/// @}
+
+protected:
+	/// Returns shared allocator, never
+	/// destroyed so that blocks can be
+	/// released at any time
+	static FORCE_INLINE MallocRecycle * getMalloc()
+	{
+		static MallocRecycle * malloc = new MallocRecycle(sizeof(T));
+		return malloc;
+	}
+};
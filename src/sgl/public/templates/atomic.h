@@ -50,6 +50,23 @@ public:
 	/// @brief Like @ref store() but returns a copy of the previous value
 	FORCE_INLINE T exchange(T val) { return PlatformAtomics::exchange(&obj, val); }
 
+	/**
+	 * @brief Stores value only if current value equals expected value
+	 * 
+	 * @param [in,out]	expected	expected value, set to current value on failure
+	 * @param [in]		val			value to store
+	 * 
+	 * @return @c true if value was stored
+	 */
+	FORCE_INLINE bool compareExchange(T & expected, T val)
+	{
+		const T prev = PlatformAtomics::compareExchange(&obj, val, expected);
+		if (prev == expected) return true;
+
+		expected = prev;
+		return false;
+	}
+
 protected:
 	/// @brief Default-constructor, default
 	BaseAtomic() = default;
@@ -36,6 +36,12 @@ using PlatformAtomics = struct UnixPlatformAtomics
 		return __sync_lock_test_and_set(val, exchange);
 	}
 	
+	template<typename Int, typename T>
+	static FORCE_INLINE typename EnableIf<IsIntegral<Int>::value & IsIntegral<T>::value, Int>::Type compareExchange(volatile Int * val, T exchange, T comparand)
+	{
+		return __sync_val_compare_and_swap(val, comparand, exchange);
+	}
+	
 	template<typename Int>
 	static FORCE_INLINE typename EnableIf<IsIntegral<Int>::value, Int>::Type read(volatile const Int * src)
 	{